@@ -1,8 +1,58 @@
 #include "Salsa20.h"
+#include "Salsa20_simd.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
 
 constexpr uint8_t Salsa20::tau[4][4];
 constexpr uint8_t Salsa20::omega[4][4];
 
+namespace {
+
+/// The kernels used for bulk encryption, widest first. Each one finishes as
+/// many blocks as it can and leaves the rest to the next.
+struct kernel_chain {
+    const char *name;
+    salsa20_simd::xor_blocks kernels[4];
+};
+
+const kernel_chain &select_kernels(salsa20_simd::xor_blocks scalar) {
+    static const kernel_chain chain = [scalar]() {
+        const char *limit = std::getenv("SALSA20_KERNEL");
+        kernel_chain result = {"scalar", {scalar, nullptr, nullptr, nullptr}};
+#if defined(SALSA20_SIMD)
+        struct {
+            const char *name;
+            bool supported;
+            salsa20_simd::xor_blocks kernel;
+        } candidates[] = {
+                {"avx512", __builtin_cpu_supports("avx512f") != 0, salsa20_simd::xor_blocks_avx512},
+                {"avx2", __builtin_cpu_supports("avx2") != 0, salsa20_simd::xor_blocks_avx2},
+                {"sse2", __builtin_cpu_supports("sse2") != 0, salsa20_simd::xor_blocks_sse2}
+        };
+        size_t count = 0;
+        bool allowed = limit == nullptr;
+        for (auto& candidate: candidates) {
+            allowed = allowed || std::strcmp(limit, candidate.name) == 0;
+            if (!allowed || !candidate.supported)
+                continue;
+            if (count == 0)
+                result.name = candidate.name;
+            result.kernels[count++] = candidate.kernel;
+        }
+        result.kernels[count] = scalar;
+#else
+        (void)limit;
+#endif
+        return result;
+    }();
+    return chain;
+}
+
+}
+
 uint32_t Salsa20::rotate(uint32_t value, uint8_t shift) {
     return (value << shift) | (value >> (32 - shift));
 }
@@ -47,47 +97,118 @@ uint32_t Salsa20::littleendian(const std::uint8_t b[4]) {
     return result;
 }
 
-uint32_t Salsa20::un_littleendian(uint8_t b[4], uint32_t w) {
+void Salsa20::un_littleendian(uint8_t b[4], uint32_t w) {
     b[0] = w;
     b[1] = w >> 8;
     b[2] = w >> 16;
     b[3] = w >> 24;
 }
 
-void Salsa20::hash(uint8_t sequence[64]) {
-    uint32_t x[16];
+Salsa20::Salsa20(const uint8_t *key, size_t key_size, const uint8_t nonce[8])
+        : m_position(0) {
+    if (key_size != 16 && key_size != 32)
+        throw std::invalid_argument("Salsa20 key must be 16 or 32 bytes");
+
+    const uint8_t (*cnst)[4] = key_size == 32 ? omega : tau;
+    const uint8_t *k1 = key_size == 32 ? key + 16 : key;
+
+    m_state[0] = littleendian(cnst[0]);
+    for (uint8_t i = 0; i < 4; ++i)
+        m_state[1 + i] = littleendian(key + 4 * i);
+    m_state[5] = littleendian(cnst[1]);
+    m_state[6] = littleendian(nonce);
+    m_state[7] = littleendian(nonce + 4);
+    m_state[8] = 0;
+    m_state[9] = 0;
+    m_state[10] = littleendian(cnst[2]);
+    for (uint8_t i = 0; i < 4; ++i)
+        m_state[11 + i] = littleendian(k1 + 4 * i);
+    m_state[15] = littleendian(cnst[3]);
+}
+
+void Salsa20::block(uint64_t counter, uint8_t keystream[CHUNK_SIZE]) const {
     uint32_t z[16];
 
-    for (std::uint8_t i = 0; i < 16; ++i)
-        x[i] = z[i] = littleendian(sequence + (4 * i));
+    std::copy(m_state, m_state + 16, z);
+    z[8] = static_cast<uint32_t>(counter);
+    z[9] = static_cast<uint32_t>(counter >> 32);
     for (std::uint8_t i = 0; i < 10; ++i)
         doubleround(z);
-    for (std::uint8_t i = 0; i < 16; ++i)
-        un_littleendian(sequence + (4 * i), z[i] + x[i]);
+    for (std::uint8_t i = 0; i < 16; ++i) {
+        uint32_t x = i == 8 ? static_cast<uint32_t>(counter) :
+                     i == 9 ? static_cast<uint32_t>(counter >> 32) : m_state[i];
+        un_littleendian(keystream + (4 * i), z[i] + x);
+    }
 }
 
+size_t Salsa20::xor_blocks(const uint32_t state[16], uint64_t counter, uint8_t *data, size_t blocks) {
+    uint32_t input[16];
+    uint32_t z[16];
+
+    std::copy(state, state + 16, input);
+    for (size_t n = 0; n < blocks; ++n, ++counter, data += CHUNK_SIZE) {
+        input[8] = static_cast<uint32_t>(counter);
+        input[9] = static_cast<uint32_t>(counter >> 32);
+        std::copy(input, input + 16, z);
+        for (std::uint8_t i = 0; i < 10; ++i)
+            doubleround(z);
+        for (std::uint8_t i = 0; i < 16; ++i) {
+            uint8_t keystream[4];
+            un_littleendian(keystream, z[i] + input[i]);
+            for (std::uint8_t k = 0; k < 4; ++k)
+                data[4 * i + k] ^= keystream[k];
+        }
+    }
+    return blocks;
+}
 
-void Salsa20::expand(
-        const uint8_t k0[16],
-        const uint8_t *k1,
-        uint8_t n[16],
-        uint8_t sequence[64]) {
-    const uint8_t (*cnst)[4] = omega;
+void Salsa20::crypt(uint8_t *buffer, size_t length, uint64_t offset) const {
+    uint64_t counter = offset / CHUNK_SIZE;
+    size_t skip = offset % CHUNK_SIZE;
+    uint8_t keystream[CHUNK_SIZE];
+
+    // Leading part of a block.
+    if (skip != 0 && length > 0) {
+        block(counter++, keystream);
+        size_t count = std::min(length, CHUNK_SIZE - skip);
+        for (size_t i = 0; i < count; ++i)
+            buffer[i] ^= keystream[skip + i];
+        buffer += count;
+        length -= count;
+    }
 
-    if (k1 == nullptr) {
-        k1 = k0;
-        cnst = tau;
+    // Whole blocks go through the widest kernel available.
+    size_t blocks = length / CHUNK_SIZE;
+    const kernel_chain &chain = select_kernels(xor_blocks);
+    for (size_t done = 0, k = 0; done < blocks; ++k)
+        done += chain.kernels[k](m_state, counter + done, buffer + CHUNK_SIZE * done, blocks - done);
+    counter += blocks;
+    buffer += CHUNK_SIZE * blocks;
+    length -= CHUNK_SIZE * blocks;
+
+    // Trailing part of a block.
+    if (length > 0) {
+        block(counter, keystream);
+        for (size_t i = 0; i < length; ++i)
+            buffer[i] ^= keystream[i];
     }
+}
+
+void Salsa20::crypt(uint8_t *buffer, size_t length) {
+    crypt(buffer, length, m_position);
+    m_position += length;
+}
 
-    std::copy(cnst[0], cnst[0] + 4, sequence);     //4
-    std::copy(k0, k0 + 16, sequence + 4);          //20
-    std::copy(cnst[1], cnst[1] + 4, sequence + 20);//24
-    std::copy(n, n + 16, sequence + 24);           //40
-    std::copy(cnst[2], cnst[2] + 4, sequence + 40);//44
-    std::copy(k1, k1 + 16, sequence + 44);         //60
-    std::copy(cnst[3], cnst[3] + 4, sequence + 60);//64
+void Salsa20::seek(uint64_t offset) {
+    m_position = offset;
+}
+
+uint64_t Salsa20::position() const {
+    return m_position;
+}
 
-    hash(sequence);
+const char *Salsa20::kernel() {
+    return select_kernels(xor_blocks).name;
 }
 
 void Salsa20::crypt16(
@@ -95,41 +216,13 @@ void Salsa20::crypt16(
         uint8_t nonce[8],
         uint8_t chunk[CHUNK_SIZE]
 ) {
-    crypt(
-            key,
-            nullptr,
-            nonce,
-            chunk
-    );
+    Salsa20(key, 16, nonce).crypt(chunk, CHUNK_SIZE, 0);
 }
+
 void Salsa20::crypt32(
         const uint8_t key[32],
         uint8_t nonce[8],
         uint8_t chunk[CHUNK_SIZE]
 ) {
-    crypt(
-            key,
-            key+16,
-            nonce,
-            chunk
-    );
+    Salsa20(key, 32, nonce).crypt(chunk, CHUNK_SIZE, 0);
 }
-
-void Salsa20::crypt(
-        const uint8_t k0[16],
-        const uint8_t *k1,
-        uint8_t nonce[8],
-        uint8_t chunk[CHUNK_SIZE]
-) {
-    uint8_t hash_seq[64];
-    uint8_t n[16] = {0};
-
-    for (uint8_t i = 0; i < 8; ++i)
-        n[i] = nonce[i];
-
-    un_littleendian(n + 8, 0);
-    expand(k0, k1, n, hash_seq);
-
-    for (size_t i = 0; i < CHUNK_SIZE; ++i)
-        chunk[i] ^= hash_seq[i];
-}
\ No newline at end of file
@@ -1,12 +1,39 @@
 #pragma once
 
 #include <tuple>
+#include <cstddef>
 #include <cstdint>
 
+/// Salsa20 stream cipher. An object holds the expanded key and nonce and
+/// encrypts (or decrypts) any part of the keystream, addressed by byte offset:
+/// block i of the stream uses block counter i.
 class Salsa20 {
 public:
     static const size_t CHUNK_SIZE = 64;
 
+    /// Set up the stream for a 16 or 32 byte key.
+    Salsa20(const uint8_t *key, size_t key_size, const uint8_t nonce[8]);
+
+    /// Encrypt length bytes of buffer in place as the part of the stream that
+    /// starts at offset. The current position is not affected.
+    void crypt(uint8_t *buffer, size_t length, uint64_t offset) const;
+
+    /// Encrypt length bytes of buffer in place at the current position and
+    /// advance the position past them.
+    void crypt(uint8_t *buffer, size_t length);
+
+    /// Move the current position to the given byte offset of the stream.
+    void seek(uint64_t offset);
+
+    /// The current byte offset in the stream.
+    uint64_t position() const;
+
+    /// The name of the keystream kernel picked for this CPU: "avx512", "avx2",
+    /// "sse2" or "scalar". The SALSA20_KERNEL environment variable may select
+    /// a narrower one, e.g. "scalar" for the reference implementation.
+    static const char *kernel();
+
+    /// Encrypt a single chunk with block counter 0.
     static void crypt16(
             const uint8_t key[16],
             uint8_t nonce[8],
@@ -19,10 +46,6 @@ public:
             uint8_t chunk[CHUNK_SIZE]
     );
 private:
-    Salsa20() = default;
-    Salsa20(const Salsa20& salsa20);
-    Salsa20& operator =(const Salsa20& salsa20);
-
     static void quarterround(
             uint32_t& y0,
             uint32_t& y1,
@@ -33,20 +56,14 @@ private:
     static void columnround(uint32_t x[16]);
     static void doubleround(uint32_t y[16]);
     static uint32_t littleendian(const uint8_t b[4]);
-    static uint32_t un_littleendian(uint8_t b[4], uint32_t w);
-    static void hash(uint8_t sequence[64]);
-    static void expand(
-            const uint8_t k0[16],
-            const uint8_t *k1,
-            uint8_t n[16],
-            uint8_t sequence[64]);
-    static void crypt(
-            const uint8_t k0[16],
-            const uint8_t *k1,
-            uint8_t nonce[8],
-            uint8_t chunk[CHUNK_SIZE]
-    );
+    static void un_littleendian(uint8_t b[4], uint32_t w);
 
+    /// Produce the keystream block with the given counter.
+    void block(uint64_t counter, uint8_t keystream[CHUNK_SIZE]) const;
+
+    /// XOR whole keystream blocks starting at counter into data, one block at a
+    /// time. This is the reference for the SIMD kernels.
+    static size_t xor_blocks(const uint32_t state[16], uint64_t counter, uint8_t *data, size_t blocks);
 
     static uint32_t rotate(uint32_t value, uint8_t shift);
 
@@ -63,4 +80,10 @@ private:
             { 50,  45,  98, 121},
             {116, 101,  32, 107}
     };
-};
\ No newline at end of file
+
+    /// The input words of the hash: constants, key, nonce and a zero counter.
+    uint32_t m_state[16];
+
+    /// The current byte offset in the stream.
+    uint64_t m_position;
+};
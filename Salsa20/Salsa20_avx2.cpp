@@ -0,0 +1,97 @@
+#include "Salsa20_simd.h"
+
+#if defined(SALSA20_SIMD) && defined(__AVX2__)
+
+#include <immintrin.h>
+
+namespace salsa20_simd {
+
+namespace {
+
+const size_t LANES = 8;
+
+inline __m256i rotate(__m256i value, int shift) {
+    return _mm256_or_si256(_mm256_slli_epi32(value, shift), _mm256_srli_epi32(value, 32 - shift));
+}
+
+inline void quarterround(__m256i& y0, __m256i& y1, __m256i& y2, __m256i& y3) {
+    y1 = _mm256_xor_si256(y1, rotate(_mm256_add_epi32(y0, y3), 7));
+    y2 = _mm256_xor_si256(y2, rotate(_mm256_add_epi32(y1, y0), 9));
+    y3 = _mm256_xor_si256(y3, rotate(_mm256_add_epi32(y2, y1), 13));
+    y0 = _mm256_xor_si256(y0, rotate(_mm256_add_epi32(y3, y2), 18));
+}
+
+/// Transpose four words within each 128-bit half: y[j] then holds the four
+/// words of block j in its low half and of block j + 4 in its high half.
+inline void transpose(const __m256i x[4], __m256i y[4]) {
+    __m256i t0 = _mm256_unpacklo_epi32(x[0], x[1]);
+    __m256i t1 = _mm256_unpacklo_epi32(x[2], x[3]);
+    __m256i t2 = _mm256_unpackhi_epi32(x[0], x[1]);
+    __m256i t3 = _mm256_unpackhi_epi32(x[2], x[3]);
+    y[0] = _mm256_unpacklo_epi64(t0, t1);
+    y[1] = _mm256_unpackhi_epi64(t0, t1);
+    y[2] = _mm256_unpacklo_epi64(t2, t3);
+    y[3] = _mm256_unpackhi_epi64(t2, t3);
+}
+
+inline void xor_256(uint8_t *data, __m256i value) {
+    __m256i *p = reinterpret_cast<__m256i *>(data);
+    _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), value));
+}
+
+}
+
+size_t xor_blocks_avx2(const uint32_t state[16], uint64_t counter, uint8_t *data, size_t blocks) {
+    size_t done = 0;
+    for (; done + LANES <= blocks; done += LANES, counter += LANES, data += 64 * LANES) {
+        uint32_t lo[LANES], hi[LANES];
+        for (size_t j = 0; j < LANES; ++j) {
+            lo[j] = static_cast<uint32_t>(counter + j);
+            hi[j] = static_cast<uint32_t>((counter + j) >> 32);
+        }
+
+        // The input words are broadcast again for the final addition rather
+        // than kept live through the rounds, which would spill registers.
+        __m256i x[16];
+        for (size_t i = 0; i < 16; ++i)
+            x[i] = _mm256_set1_epi32(static_cast<int>(state[i]));
+        x[8] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lo));
+        x[9] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(hi));
+
+        for (int i = 0; i < 10; ++i) {
+            quarterround(x[0], x[4], x[8], x[12]);
+            quarterround(x[5], x[9], x[13], x[1]);
+            quarterround(x[10], x[14], x[2], x[6]);
+            quarterround(x[15], x[3], x[7], x[11]);
+            quarterround(x[0], x[1], x[2], x[3]);
+            quarterround(x[5], x[6], x[7], x[4]);
+            quarterround(x[10], x[11], x[8], x[9]);
+            quarterround(x[15], x[12], x[13], x[14]);
+        }
+        for (size_t i = 0; i < 16; ++i)
+            if (i != 8 && i != 9)
+                x[i] = _mm256_add_epi32(x[i], _mm256_set1_epi32(static_cast<int>(state[i])));
+        x[8] = _mm256_add_epi32(x[8], _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lo)));
+        x[9] = _mm256_add_epi32(x[9], _mm256_loadu_si256(reinterpret_cast<const __m256i *>(hi)));
+
+        __m256i y[4][4];
+        for (size_t g = 0; g < 4; ++g)
+            transpose(x + 4 * g, y[g]);
+
+        // Join the word groups of each block: the low halves belong to blocks
+        // 0-3, the high halves to blocks 4-7.
+        for (size_t j = 0; j < 4; ++j) {
+            uint8_t *low = data + 64 * j;
+            uint8_t *high = data + 64 * (j + 4);
+            xor_256(low, _mm256_permute2x128_si256(y[0][j], y[1][j], 0x20));
+            xor_256(low + 32, _mm256_permute2x128_si256(y[2][j], y[3][j], 0x20));
+            xor_256(high, _mm256_permute2x128_si256(y[0][j], y[1][j], 0x31));
+            xor_256(high + 32, _mm256_permute2x128_si256(y[2][j], y[3][j], 0x31));
+        }
+    }
+    return done;
+}
+
+}
+
+#endif
@@ -0,0 +1,91 @@
+#include "Salsa20_simd.h"
+
+#if defined(SALSA20_SIMD) && defined(__AVX512F__)
+
+#include <immintrin.h>
+
+namespace salsa20_simd {
+
+namespace {
+
+const size_t LANES = 16;
+
+inline void quarterround(__m512i& y0, __m512i& y1, __m512i& y2, __m512i& y3) {
+    y1 = _mm512_xor_si512(y1, _mm512_rol_epi32(_mm512_add_epi32(y0, y3), 7));
+    y2 = _mm512_xor_si512(y2, _mm512_rol_epi32(_mm512_add_epi32(y1, y0), 9));
+    y3 = _mm512_xor_si512(y3, _mm512_rol_epi32(_mm512_add_epi32(y2, y1), 13));
+    y0 = _mm512_xor_si512(y0, _mm512_rol_epi32(_mm512_add_epi32(y3, y2), 18));
+}
+
+/// Transpose four words within each 128-bit lane: y[j] then holds the four
+/// words of block 4 * l + j in lane l.
+inline void transpose(const __m512i x[4], __m512i y[4]) {
+    __m512i t0 = _mm512_unpacklo_epi32(x[0], x[1]);
+    __m512i t1 = _mm512_unpacklo_epi32(x[2], x[3]);
+    __m512i t2 = _mm512_unpackhi_epi32(x[0], x[1]);
+    __m512i t3 = _mm512_unpackhi_epi32(x[2], x[3]);
+    y[0] = _mm512_unpacklo_epi64(t0, t1);
+    y[1] = _mm512_unpackhi_epi64(t0, t1);
+    y[2] = _mm512_unpacklo_epi64(t2, t3);
+    y[3] = _mm512_unpackhi_epi64(t2, t3);
+}
+
+inline void xor_512(uint8_t *data, __m512i value) {
+    _mm512_storeu_si512(data, _mm512_xor_si512(_mm512_loadu_si512(data), value));
+}
+
+}
+
+size_t xor_blocks_avx512(const uint32_t state[16], uint64_t counter, uint8_t *data, size_t blocks) {
+    size_t done = 0;
+    for (; done + LANES <= blocks; done += LANES, counter += LANES, data += 64 * LANES) {
+        uint32_t lo[LANES], hi[LANES];
+        for (size_t j = 0; j < LANES; ++j) {
+            lo[j] = static_cast<uint32_t>(counter + j);
+            hi[j] = static_cast<uint32_t>((counter + j) >> 32);
+        }
+
+        __m512i in[16], x[16];
+        for (size_t i = 0; i < 16; ++i)
+            in[i] = _mm512_set1_epi32(static_cast<int>(state[i]));
+        in[8] = _mm512_loadu_si512(lo);
+        in[9] = _mm512_loadu_si512(hi);
+        for (size_t i = 0; i < 16; ++i)
+            x[i] = in[i];
+
+        for (int i = 0; i < 10; ++i) {
+            quarterround(x[0], x[4], x[8], x[12]);
+            quarterround(x[5], x[9], x[13], x[1]);
+            quarterround(x[10], x[14], x[2], x[6]);
+            quarterround(x[15], x[3], x[7], x[11]);
+            quarterround(x[0], x[1], x[2], x[3]);
+            quarterround(x[5], x[6], x[7], x[4]);
+            quarterround(x[10], x[11], x[8], x[9]);
+            quarterround(x[15], x[12], x[13], x[14]);
+        }
+        for (size_t i = 0; i < 16; ++i)
+            x[i] = _mm512_add_epi32(x[i], in[i]);
+
+        __m512i y[4][4];
+        for (size_t g = 0; g < 4; ++g)
+            transpose(x + 4 * g, y[g]);
+
+        // Transpose the 128-bit lanes: for each j, lane l of the word groups
+        // y[0..3][j] makes up block 4 * l + j.
+        for (size_t j = 0; j < 4; ++j) {
+            __m512i a = _mm512_shuffle_i32x4(y[0][j], y[1][j], _MM_SHUFFLE(1, 0, 1, 0));
+            __m512i b = _mm512_shuffle_i32x4(y[2][j], y[3][j], _MM_SHUFFLE(1, 0, 1, 0));
+            __m512i c = _mm512_shuffle_i32x4(y[0][j], y[1][j], _MM_SHUFFLE(3, 2, 3, 2));
+            __m512i d = _mm512_shuffle_i32x4(y[2][j], y[3][j], _MM_SHUFFLE(3, 2, 3, 2));
+            xor_512(data + 64 * j, _mm512_shuffle_i32x4(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+            xor_512(data + 64 * (j + 4), _mm512_shuffle_i32x4(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+            xor_512(data + 64 * (j + 8), _mm512_shuffle_i32x4(c, d, _MM_SHUFFLE(2, 0, 2, 0)));
+            xor_512(data + 64 * (j + 12), _mm512_shuffle_i32x4(c, d, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+    }
+    return done;
+}
+
+}
+
+#endif
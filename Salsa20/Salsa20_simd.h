@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Multi-block Salsa20 keystream kernels. Each kernel computes several
+/// consecutive blocks in parallel SIMD lanes and XORs them into data.
+///
+/// state is the 16-word input of the hash with the counter words ignored,
+/// counter is the block counter of the first block of data. A kernel only
+/// handles whole groups of its lane count and returns the number of blocks
+/// it processed; the caller finishes the rest with a narrower kernel.
+namespace salsa20_simd {
+
+typedef size_t (*xor_blocks)(
+        const uint32_t state[16],
+        uint64_t counter,
+        uint8_t *data,
+        size_t blocks
+);
+
+#if defined(SALSA20_SIMD)
+/// 4 blocks per iteration.
+size_t xor_blocks_sse2(const uint32_t state[16], uint64_t counter, uint8_t *data, size_t blocks);
+
+/// 8 blocks per iteration.
+size_t xor_blocks_avx2(const uint32_t state[16], uint64_t counter, uint8_t *data, size_t blocks);
+
+/// 16 blocks per iteration.
+size_t xor_blocks_avx512(const uint32_t state[16], uint64_t counter, uint8_t *data, size_t blocks);
+#endif
+}
@@ -0,0 +1,86 @@
+#include "Salsa20_simd.h"
+
+#if defined(SALSA20_SIMD) && defined(__SSE2__)
+
+#include <emmintrin.h>
+
+namespace salsa20_simd {
+
+namespace {
+
+const size_t LANES = 4;
+
+inline __m128i rotate(__m128i value, int shift) {
+    return _mm_or_si128(_mm_slli_epi32(value, shift), _mm_srli_epi32(value, 32 - shift));
+}
+
+inline void quarterround(__m128i& y0, __m128i& y1, __m128i& y2, __m128i& y3) {
+    y1 = _mm_xor_si128(y1, rotate(_mm_add_epi32(y0, y3), 7));
+    y2 = _mm_xor_si128(y2, rotate(_mm_add_epi32(y1, y0), 9));
+    y3 = _mm_xor_si128(y3, rotate(_mm_add_epi32(y2, y1), 13));
+    y0 = _mm_xor_si128(y0, rotate(_mm_add_epi32(y3, y2), 18));
+}
+
+/// Transpose four words of four blocks so that each vector holds the four
+/// words of one block, and XOR them into the payload.
+inline void xor_words(const __m128i x[4], uint8_t *data) {
+    __m128i t0 = _mm_unpacklo_epi32(x[0], x[1]);
+    __m128i t1 = _mm_unpacklo_epi32(x[2], x[3]);
+    __m128i t2 = _mm_unpackhi_epi32(x[0], x[1]);
+    __m128i t3 = _mm_unpackhi_epi32(x[2], x[3]);
+    __m128i y[4] = {
+            _mm_unpacklo_epi64(t0, t1),
+            _mm_unpackhi_epi64(t0, t1),
+            _mm_unpacklo_epi64(t2, t3),
+            _mm_unpackhi_epi64(t2, t3)
+    };
+    for (size_t j = 0; j < LANES; ++j) {
+        __m128i *p = reinterpret_cast<__m128i *>(data + 64 * j);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), y[j]));
+    }
+}
+
+}
+
+size_t xor_blocks_sse2(const uint32_t state[16], uint64_t counter, uint8_t *data, size_t blocks) {
+    size_t done = 0;
+    for (; done + LANES <= blocks; done += LANES, counter += LANES, data += 64 * LANES) {
+        uint32_t lo[LANES], hi[LANES];
+        for (size_t j = 0; j < LANES; ++j) {
+            lo[j] = static_cast<uint32_t>(counter + j);
+            hi[j] = static_cast<uint32_t>((counter + j) >> 32);
+        }
+
+        // The input words are broadcast again for the final addition rather
+        // than kept live through the rounds, which would spill registers.
+        __m128i x[16];
+        for (size_t i = 0; i < 16; ++i)
+            x[i] = _mm_set1_epi32(static_cast<int>(state[i]));
+        x[8] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lo));
+        x[9] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(hi));
+
+        for (int i = 0; i < 10; ++i) {
+            quarterround(x[0], x[4], x[8], x[12]);
+            quarterround(x[5], x[9], x[13], x[1]);
+            quarterround(x[10], x[14], x[2], x[6]);
+            quarterround(x[15], x[3], x[7], x[11]);
+            quarterround(x[0], x[1], x[2], x[3]);
+            quarterround(x[5], x[6], x[7], x[4]);
+            quarterround(x[10], x[11], x[8], x[9]);
+            quarterround(x[15], x[12], x[13], x[14]);
+        }
+        for (size_t i = 0; i < 16; ++i)
+            if (i != 8 && i != 9)
+                x[i] = _mm_add_epi32(x[i], _mm_set1_epi32(static_cast<int>(state[i])));
+        x[8] = _mm_add_epi32(x[8], _mm_loadu_si128(reinterpret_cast<const __m128i *>(lo)));
+        x[9] = _mm_add_epi32(x[9], _mm_loadu_si128(reinterpret_cast<const __m128i *>(hi)));
+
+        for (size_t g = 0; g < 4; ++g)
+            xor_words(x + 4 * g, data + 16 * g);
+    }
+    return done;
+}
+
+}
+
+#endif
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// A minimal microbenchmark harness. Every benchmark runs its operation in
+/// batches of growing size until a batch takes long enough to time reliably,
+/// and reports time, throughput and heap allocations per operation.
+namespace bench {
+
+/// Number of heap allocations made by the process so far. Defined by the
+/// benchmark executable, which counts calls to operator new.
+std::uint64_t allocations();
+
+/// Keep the compiler from optimizing away a value that is never used.
+template <typename T>
+inline void do_not_optimize(T& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    volatile char sink = *reinterpret_cast<volatile char *>(&value);
+    (void)sink;
+#endif
+}
+
+struct result {
+    std::string name;
+    std::uint64_t iterations;
+    double ns_per_op;
+    double bytes_per_second;
+    double allocations_per_op;
+};
+
+class runner {
+public:
+    /// Only benchmarks whose name contains filter are run.
+    runner(const std::string& filter, double min_seconds)
+        : m_filter(filter), m_min_seconds(min_seconds) {}
+
+    /// Benchmark op, which processes bytes_per_op bytes per call (0 if
+    /// throughput makes no sense for it).
+    void run(const std::string& name, std::size_t bytes_per_op, const std::function<void()>& op) {
+        if (name.find(m_filter) == std::string::npos)
+            return;
+
+        typedef std::chrono::steady_clock clock;
+        op();   // warm up caches and lazily initialized state
+        for (std::uint64_t iterations = 1;; iterations *= 2) {
+            std::uint64_t allocations_before = allocations();
+            clock::time_point start = clock::now();
+            for (std::uint64_t i = 0; i < iterations; ++i)
+                op();
+            double seconds = std::chrono::duration<double>(clock::now() - start).count();
+            std::uint64_t allocated = allocations() - allocations_before;
+
+            if (seconds >= m_min_seconds || iterations >= (1ull << 40)) {
+                result r;
+                r.name = name;
+                r.iterations = iterations;
+                r.ns_per_op = seconds * 1e9 / iterations;
+                r.bytes_per_second = bytes_per_op * iterations / seconds;
+                r.allocations_per_op = static_cast<double>(allocated) / iterations;
+                m_results.push_back(r);
+                return;
+            }
+        }
+    }
+
+    /// Write all results as a JSON document.
+    void write_json(std::ostream& os, const std::string& salsa20_kernel) const {
+        os << "{\n  \"salsa20_kernel\": \"" << salsa20_kernel << "\",\n  \"benchmarks\": [";
+        for (std::size_t i = 0; i < m_results.size(); ++i) {
+            const result& r = m_results[i];
+            os << (i ? "," : "") << "\n    {"
+               << "\"name\": \"" << r.name << "\", "
+               << "\"iterations\": " << r.iterations << ", "
+               << "\"ns_per_op\": " << r.ns_per_op << ", "
+               << "\"bytes_per_second\": " << r.bytes_per_second << ", "
+               << "\"allocations_per_op\": " << r.allocations_per_op << "}";
+        }
+        os << "\n  ]\n}" << std::endl;
+    }
+
+private:
+    std::string m_filter;
+    double m_min_seconds;
+    std::vector<result> m_results;
+};
+
+}
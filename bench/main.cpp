@@ -0,0 +1,267 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "bench.hpp"
+#include "../args_serializer.h"
+#include "../Salsa20/Salsa20.h"
+#include "../server/arena.hpp"
+#include "../server/mime_types.hpp"
+#include "../server/reply.hpp"
+#include "../server/request.hpp"
+#include "../server/request_handler.hpp"
+#include "../server/request_parser.hpp"
+
+namespace {
+std::atomic<std::uint64_t> allocation_count(0);
+}
+
+std::uint64_t bench::allocations() {
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+void *operator new(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+using namespace http::server;
+
+namespace {
+
+const std::uint8_t key[32] = {
+        '0', '1', '2', '4', 'n', ';', 'v', 's', 'd', 'a', 'w', 'd', '-', 'j', 'm', 't',
+        'd', 'a', 's', 'd', 'a', 'g', 'k', 'd', 'f', 'g', 'j', 'k', 'n', 'j', 'e', 'w'
+};
+
+const char request_text[] =
+        "GET /index.html?id=0 HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9\r\n"
+        "Accept-Encoding: gzip, deflate\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n";
+
+/// A temporary document root with files of a few sizes, removed on exit.
+class doc_root {
+public:
+    explicit doc_root(const std::vector<std::size_t>& sizes) {
+        char dir[] = "/tmp/http_bench.XXXXXX";
+        if (mkdtemp(dir) == nullptr)
+            throw std::runtime_error("can't create temporary doc root");
+        m_path = dir;
+        for (std::size_t size: sizes) {
+            std::ofstream os(m_path + "/" + name(size), std::ios::binary);
+            std::string content(size, 'x');
+            os.write(content.data(), content.size());
+            m_files.push_back(m_path + "/" + name(size));
+        }
+    }
+
+    ~doc_root() {
+        for (const std::string& file: m_files)
+            std::remove(file.c_str());
+        rmdir(m_path.c_str());
+    }
+
+    const std::string& path() const {
+        return m_path;
+    }
+
+    static std::string name(std::size_t size) {
+        return "file_" + std::to_string(size) + ".bin";
+    }
+
+private:
+    std::string m_path;
+    std::vector<std::string> m_files;
+};
+
+void bench_salsa20(bench::runner& runner) {
+    const std::uint8_t nonce_init[8] = {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h'};
+    for (std::size_t size: {64, 1024, 16384, 1048576}) {
+        std::vector<std::uint8_t> buffer(size);
+        std::string suffix = "/" + std::to_string(size);
+
+        runner.run("Salsa20::crypt16" + suffix, size, [&]() {
+            for (std::size_t i = 0; i < size; i += Salsa20::CHUNK_SIZE) {
+                std::uint8_t nonce[8] = {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h'};
+                Salsa20::crypt16(key, nonce, buffer.data() + i);
+            }
+            bench::do_not_optimize(buffer);
+        });
+        runner.run("Salsa20::crypt32" + suffix, size, [&]() {
+            for (std::size_t i = 0; i < size; i += Salsa20::CHUNK_SIZE) {
+                std::uint8_t nonce[8] = {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h'};
+                Salsa20::crypt32(key, nonce, buffer.data() + i);
+            }
+            bench::do_not_optimize(buffer);
+        });
+
+        Salsa20 cipher(key, 16, nonce_init);
+        runner.run("Salsa20::crypt" + suffix, size, [&]() {
+            cipher.crypt(buffer.data(), buffer.size(), 0);
+            bench::do_not_optimize(buffer);
+        });
+    }
+}
+
+void bench_request_parser(bench::runner& runner) {
+    const char *begin = request_text;
+    const char *end = request_text + sizeof(request_text) - 1;
+    request_parser parser;
+    runner.run("request_parser::parse", end - begin, [&]() {
+        request req = request();
+        parser.reset();
+        auto result = parser.parse(req, begin, end);
+        bench::do_not_optimize(result);
+    });
+}
+
+void bench_url_decode(bench::runner& runner) {
+    for (const char *uri: {"/index.html?id=0", "/some%20dir/file+name.html?id=12&lang=en%2Dus&v=3"}) {
+        std::string in = uri;
+        decoded_uri out;
+        runner.run(std::string("request_handler::url_decode/") + uri, in.size(), [&]() {
+            bool ok = request_handler::url_decode(in, out);
+            bench::do_not_optimize(ok);
+        });
+    }
+}
+
+void bench_mime_types(bench::runner& runner) {
+    for (const char *extension: {"html", "png", "unknown"}) {
+        std::string in = extension;
+        runner.run(std::string("mime_types::extension_to_type/") + extension, 0, [&]() {
+            std::string type = mime_types::extension_to_type(in);
+            bench::do_not_optimize(type);
+        });
+    }
+}
+
+void bench_reply(bench::runner& runner) {
+    reply rep;
+    rep.status = reply::ok;
+    rep.headers.resize(3);
+    rep.headers[0].name = "Content-Length";
+    rep.headers[0].value = "4096";
+    rep.headers[1].name = "Content-Type";
+    rep.headers[1].value = "text/html";
+    rep.headers[2].name = "Connection";
+    rep.headers[2].value = "keep-alive";
+    // The connection reuses its buffer vector from write to write.
+    std::vector<boost::asio::const_buffer> buffers;
+    runner.run("reply::to_buffers", 0, [&]() {
+        buffers.clear();
+        rep.to_buffers(buffers);
+        bench::do_not_optimize(buffers);
+    });
+    runner.run("reply::stock_reply", 0, [&]() {
+        reply stock = reply::stock_reply(reply::not_found);
+        bench::do_not_optimize(stock);
+    });
+}
+
+void bench_handle_request(bench::runner& runner) {
+    std::vector<std::size_t> sizes = {1024, 65536, 1048576};
+    doc_root root(sizes);
+    std::map<int, std::string> clients = {{0, "0124n;vsdawd-jmt"}};
+    // The response cache is off so that the reads and the encryption are
+    // measured; the cached path is measured separately.
+    request_handler handler(root.path(), clients, 0);
+    request_handler cached_handler(root.path(), clients);
+    std::vector<char> chunk(16384);
+
+    for (std::size_t size: sizes) {
+        request req = request();
+        req.method = "GET";
+        req.uri = "/" + doc_root::name(size) + "?id=0";
+        req.http_version_major = 1;
+        req.http_version_minor = 1;
+        // The reply and the arena are reused like a connection does.
+        reply rep;
+        arena storage;
+        runner.run("request_handler::handle_request/" + std::to_string(size), size, [&]() {
+            handler.handle_request(req, rep, storage);
+            if (rep.body)
+                while (rep.body->read(chunk.data(), chunk.size()) > 0) {}
+            bench::do_not_optimize(rep);
+            rep.clear();
+            storage.reset();
+        });
+        runner.run("request_handler::handle_request/cached/" + std::to_string(size), size, [&]() {
+            cached_handler.handle_request(req, rep, storage);
+            if (rep.body)
+                while (rep.body->read(chunk.data(), chunk.size()) > 0) {}
+            bench::do_not_optimize(rep);
+            rep.clear();
+            storage.reset();
+        });
+    }
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    serialize::map smap;
+    std::string filter;
+    double min_seconds = 0.2;
+
+    serialize::args(argc, argv, smap)
+    .handle("filter", [&] (const serialize::values& values, const std::string& error) {
+        filter = !values.empty() ? values.front() : "";
+    })
+    .handle("time", [&] (const serialize::values& values, const std::string& error) {
+        for (const std::string& value : values) {
+            std::stringstream buffer(value);
+            buffer >> min_seconds;
+        }
+        if (min_seconds <= 0) min_seconds = 0.2;
+    });
+
+    try {
+        bench::runner runner(filter, min_seconds);
+        bench_salsa20(runner);
+        bench_request_parser(runner);
+        bench_url_decode(runner);
+        bench_mime_types(runner);
+        bench_reply(runner);
+        bench_handle_request(runner);
+        runner.write_json(std::cout, Salsa20::kernel());
+    } catch (std::exception& e) {
+        std::cerr << "exception: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -9,6 +9,13 @@
 //
 
 #include "client.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+#include <unistd.h>
+#include <boost/algorithm/string/predicate.hpp>
 #include "../Salsa20/Salsa20.h"
 
 using boost::asio::ip::tcp;
@@ -16,7 +23,57 @@ using boost::asio::ip::tcp;
 namespace http {
 namespace client {
 
-client::client(int id, const std::string& key): m_id(id) {
+namespace {
+
+const std::uint8_t nonce[8] = {'a', 'b', 'c', 'd', 'e', 'f', 'g' , 'h'};
+
+/// Split a header line into its name and its value, without the spaces and
+/// the CR around it. Returns false if there is no colon.
+bool split_header(const std::string& line, std::string& name, std::string& value) {
+    std::size_t colon = line.find(':');
+    if (colon == std::string::npos)
+        return false;
+    name = line.substr(0, colon);
+    value = line.substr(colon + 1);
+    value.erase(0, value.find_first_not_of(' '));
+    value.erase(value.find_last_not_of("\r ") + 1);
+    return true;
+}
+
+/// Parse the value of a Content-Range header, "bytes first-last/size", into
+/// the offset of the first byte and the number of bytes.
+bool parse_content_range(const std::string& value, std::uint64_t& first, std::uint64_t& length) {
+    if (value.compare(0, 6, "bytes ") != 0)
+        return false;
+    const char* p = value.c_str() + 6;
+    char* end;
+    first = std::strtoull(p, &end, 10);
+    if (end == p || *end != '-')
+        return false;
+    p = end + 1;
+    std::uint64_t last = std::strtoull(p, &end, 10);
+    if (end == p || *end != '/' || last < first)
+        return false;
+    length = last - first + 1;
+    return true;
+}
+
+/// The value of a Range header asking for ranges.
+std::string range_value(const std::vector<client::byte_range>& ranges) {
+    std::string value = "bytes=";
+    for (const client::byte_range& r: ranges) {
+        if (&r != &ranges.front())
+            value += ',';
+        value += std::to_string(r.first) + '-';
+        if (r.length > 0)
+            value += std::to_string(r.first + r.length - 1);
+    }
+    return value;
+}
+
+}
+
+client::client(int id, const std::string& key): m_id(id), m_key(), m_body(body_chunk_size) {
     for (size_t i = 0; i < key.length() && i < sizeof(m_key); ++i)
         m_key[i] = (std::uint8_t)key[i];
 };
@@ -25,66 +82,504 @@ void client::get(
         const std::string &address, const std::string &port,
         const std::string &path, std::stringstream& result) {
     result.clear();
-    boost::asio::io_service io_service;
+    get(address, port, std::vector<std::string>(1, path),
+        [&result](const std::string&, std::stringstream& response) {
+            result << response.rdbuf();
+        });
+}
+
+void client::get(
+        const std::string &address, const std::string &port,
+        const std::vector<std::string>& paths, const response_handler& handler) {
+    std::stringstream response;
+    stream(address, port, paths,
+           [&response, &handler](const std::string& path, unsigned status, const std::string& headers) {
+        response.str(std::string());
+        response.clear();
+        write_status(response, status, headers);
+        body_sink write = ostream_sink(response);
+        return body_sink([&response, &handler, path, write](const char* data, std::size_t size) {
+            if (data)
+                write(data, size);
+            else
+                handler(path, response);
+        });
+    });
+}
 
-    // Get a list of endpoints corresponding to the server name.
-    tcp::resolver resolver(io_service);
-    tcp::resolver::query query(address, port);
-    tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
+void client::stream(
+        const std::string &address, const std::string &port,
+        const std::vector<std::string>& paths, const stream_handler& handler) {
+    std::size_t next = 0;
+    while (next < paths.size()) {
+        std::unique_ptr<connection> c = acquire(address, port);
 
-    // Try each endpoint until we successfully establish a connection.
-    tcp::socket socket(io_service);
-    boost::asio::connect(socket, endpoint_iterator);
+        // Send a window of requests ahead of their responses. The window is
+        // bounded so that neither side blocks writing while the other does.
+        std::size_t end = std::min(paths.size(), next + max_pipelined_requests);
+        boost::asio::streambuf request;
+        std::ostream request_stream(&request);
+        for (std::size_t i = next; i < end; ++i)
+            write_request(request_stream, address, paths[i]);
+
+        boost::system::error_code error;
+        boost::asio::write(c->socket, request, error);
+
+        bool keep_alive = !error;
+        std::size_t i = next;
+        for (; i < end && keep_alive; ++i) {
+            keep_alive = read_response(*c, paths[i], handler, error);
+            if (error)
+                break;
+        }
 
-    // Form the request. We specify the "Connection: close" header so that the
-    // server will close the socket after transmitting the response. This will
-    // allow us to treat all data up until the EOF as the content.
+        // A pooled connection the server has closed meanwhile fails before the
+        // first response; send the window again on another connection.
+        if (error && !c->reused)
+            throw boost::system::system_error(error);
+
+        next = i;
+        if (keep_alive && !error)
+            release(address, port, std::move(c));
+    }
+}
+
+unsigned client::get_ranges(
+        const std::string &address, const std::string &port,
+        const std::string &path, const std::vector<byte_range>& ranges, const range_sink& sink) {
     boost::asio::streambuf request;
     std::ostream request_stream(&request);
-    request_stream << "GET " << path << "?id=" << m_id << " HTTP/1.0\r\n";
+    write_request(request_stream, address, path, range_value(ranges));
+
+    for (;;) {
+        std::unique_ptr<connection> c = acquire(address, port);
+        boost::system::error_code error;
+        boost::asio::write(c->socket, request.data(), error);
+
+        unsigned status = 0;
+        bool keep_alive = !error && read_ranges(*c, status, sink, error);
+
+        // A pooled connection the server has closed meanwhile fails before the
+        // response; send the request again on another connection.
+        if (error && c->reused)
+            continue;
+        if (error)
+            throw boost::system::system_error(error);
+        if (keep_alive)
+            release(address, port, std::move(c));
+        return status;
+    }
+}
+
+/// The paths of a concurrent fetch and the responses not handed over yet.
+struct client::fetch_operation {
+    client& owner;
+    const std::string& address;
+    const std::string& port;
+    const std::vector<std::string>& paths;
+    bool ordered;
+    const response_handler& handler;
+
+    /// The next path to send.
+    std::size_t next;
+    /// The next path to hand over in ordered mode.
+    std::size_t delivered;
+    /// Responses that completed ahead of their turn in ordered mode.
+    std::vector<std::unique_ptr<std::stringstream>> completed;
+    /// The first error that stopped a connection.
+    boost::system::error_code error;
+
+    void deliver(std::size_t index, std::unique_ptr<std::stringstream> response) {
+        if (!ordered) {
+            handler(paths[index], *response);
+            return;
+        }
+        completed[index] = std::move(response);
+        for (; delivered < paths.size() && completed[delivered]; ++delivered) {
+            handler(paths[delivered], *completed[delivered]);
+            completed[delivered].reset();
+        }
+    }
+};
+
+/// One connection of a concurrent fetch, taking paths in turn until none
+/// are left.
+class client::fetch_connection {
+public:
+    explicit fetch_connection(fetch_operation& op)
+            : m_op(op), m_index(0), m_cipher(op.owner.m_key, sizeof(op.owner.m_key), nonce),
+              m_body(body_chunk_size) {}
+
+    void start() {
+        m_connection = m_op.owner.take_idle(m_op.address, m_op.port);
+        do_next();
+    }
+
+private:
+    void do_connect() {
+        m_connection.reset(new connection(m_op.owner.m_io_context));
+        boost::asio::async_connect(m_connection->socket, m_op.owner.resolve(m_op.address, m_op.port),
+                [this](boost::system::error_code ec, const tcp::endpoint&) {
+                    if (ec) {
+                        fail(ec);
+                        return;
+                    }
+                    m_connection->socket.set_option(tcp::no_delay(true), ec);
+                    do_send();
+                });
+    }
+
+    void do_next() {
+        if (m_op.error || m_op.next == m_op.paths.size()) {
+            if (m_connection)
+                m_op.owner.release(m_op.address, m_op.port, std::move(m_connection));
+            return;
+        }
+        m_index = m_op.next++;
+        if (m_connection)
+            do_send();
+        else
+            do_connect();
+    }
+
+    void do_send() {
+        std::stringstream request;
+        m_op.owner.write_request(request, m_op.address, m_op.paths[m_index]);
+        m_request = request.str();
+        boost::asio::async_write(m_connection->socket, boost::asio::buffer(m_request),
+                [this](boost::system::error_code ec, std::size_t) {
+                    if (ec)
+                        fail(ec);
+                    else
+                        do_read_head();
+                });
+    }
+
+    void do_read_head() {
+        boost::asio::async_read_until(m_connection->socket, m_connection->buffer, "\r\n\r\n",
+                [this](boost::system::error_code ec, std::size_t) {
+                    if (ec) {
+                        fail(ec);
+                        return;
+                    }
+                    m_connection->reused = false;
+                    m_head = parse_head(m_connection->buffer);
+                    m_response.reset(new std::stringstream);
+                    write_status(*m_response, m_head.status, m_head.headers);
+                    if (!m_head.status) {
+                        m_head.keep_alive = false;
+                        finish();
+                        return;
+                    }
+                    m_cipher.seek(0);
+                    do_read_body();
+                });
+    }
+
+    void do_read_body() {
+        // Decode whatever has been received; reads never go past the body.
+        boost::asio::streambuf& buffer = m_connection->buffer;
+        while (m_head.length > 0 && buffer.size() > 0) {
+            std::size_t count = buffer.sgetn(m_body.data(),
+                    static_cast<std::size_t>(std::min<std::uint64_t>(m_head.length, m_body.size())));
+            consume(count);
+        }
+        if (m_head.length == 0) {
+            finish();
+            return;
+        }
+
+        std::size_t count = static_cast<std::size_t>(std::min<std::uint64_t>(m_head.length, m_body.size()));
+        m_connection->socket.async_read_some(boost::asio::buffer(m_body.data(), count),
+                [this](boost::system::error_code ec, std::size_t count) {
+                    if (ec == boost::asio::error::eof && !m_head.has_length) {
+                        finish();
+                        return;
+                    }
+                    if (ec) {
+                        fail(ec);
+                        return;
+                    }
+                    consume(count);
+                    do_read_body();
+                });
+    }
+
+    void consume(std::size_t count) {
+        m_cipher.crypt(reinterpret_cast<std::uint8_t *>(m_body.data()), count);
+        if (m_head.status == 200)
+            m_response->write(m_body.data(), count);
+        m_head.length -= count;
+    }
+
+    void finish() {
+        m_op.deliver(m_index, std::move(m_response));
+        if (!m_head.keep_alive)
+            m_connection.reset();
+        do_next();
+    }
+
+    void fail(const boost::system::error_code& ec) {
+        // A pooled connection the server has closed meanwhile fails before the
+        // first response; send the request again on a new connection.
+        bool retry = m_connection->reused;
+        m_connection.reset();
+        if (retry) {
+            do_connect();
+            return;
+        }
+        if (!m_op.error)
+            m_op.error = ec;
+    }
+
+    fetch_operation& m_op;
+    std::unique_ptr<connection> m_connection;
+    std::string m_request;
+    std::size_t m_index;
+    response_head m_head;
+    std::unique_ptr<std::stringstream> m_response;
+    Salsa20 m_cipher;
+    std::vector<char> m_body;
+};
+
+void client::fetch(
+        const std::string &address, const std::string &port,
+        const std::vector<std::string>& paths, std::size_t parallel, bool ordered,
+        const response_handler& handler) {
+    fetch_operation op{*this, address, port, paths, ordered, handler, 0, 0,
+                       std::vector<std::unique_ptr<std::stringstream>>(ordered ? paths.size() : 0),
+                       boost::system::error_code()};
+
+    // Resolve before starting, so that connections never block on it.
+    resolve(address, port);
+
+    std::vector<std::unique_ptr<fetch_connection>> connections;
+    for (std::size_t i = 0; i < std::min(std::max<std::size_t>(parallel, 1), paths.size()); ++i) {
+        connections.emplace_back(new fetch_connection(op));
+        connections.back()->start();
+    }
+    m_io_context.restart();
+    m_io_context.run();
+
+    if (op.error)
+        throw boost::system::system_error(op.error);
+}
+
+client::body_sink client::ostream_sink(std::ostream& stream) {
+    return [&stream](const char* data, std::size_t size) {
+        if (data)
+            stream.write(data, size);
+    };
+}
+
+client::body_sink client::fd_sink(int fd) {
+    return [fd](const char* data, std::size_t size) {
+        while (data && size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw boost::system::system_error(errno, boost::system::system_category());
+            }
+            data += written;
+            size -= written;
+        }
+    };
+}
+
+const tcp::resolver::results_type& client::resolve(const std::string& address, const std::string& port) {
+    std::string key = address + ":" + port;
+    auto it = m_endpoints.find(key);
+    if (it == m_endpoints.end()) {
+        tcp::resolver resolver(m_io_context);
+        it = m_endpoints.emplace(key, resolver.resolve(address, port)).first;
+    }
+    return it->second;
+}
+
+std::unique_ptr<client::connection> client::take_idle(const std::string& address, const std::string& port) {
+    std::vector<std::unique_ptr<connection>>& idle = m_pool[address + ":" + port];
+    if (idle.empty())
+        return nullptr;
+    std::unique_ptr<connection> c = std::move(idle.back());
+    idle.pop_back();
+    c->reused = true;
+    return c;
+}
+
+std::unique_ptr<client::connection> client::acquire(const std::string& address, const std::string& port) {
+    std::unique_ptr<connection> c = take_idle(address, port);
+    if (c)
+        return c;
+
+    // Try each endpoint until we successfully establish a connection.
+    c.reset(new connection(m_io_context));
+    boost::asio::connect(c->socket, resolve(address, port));
+    c->socket.set_option(tcp::no_delay(true));
+    return c;
+}
+
+void client::release(const std::string& address, const std::string& port, std::unique_ptr<connection> c) {
+    std::vector<std::unique_ptr<connection>>& idle = m_pool[address + ":" + port];
+    if (idle.size() < max_idle_connections)
+        idle.push_back(std::move(c));
+}
+
+void client::write_request(std::ostream& request_stream, const std::string& address, const std::string& path,
+                           const std::string& range) const {
+    request_stream << "GET " << path << "?id=" << m_id << " HTTP/1.1\r\n";
 
     // Encrypt host address
     std::string address_ = address;
-    for (size_t i = 0; i < address_.length() / Salsa20::CHUNK_SIZE; ++i) {
-        char c_buffer[Salsa20::CHUNK_SIZE] = {0};
-        for (size_t k = 0; k < Salsa20::CHUNK_SIZE; ++k)
-            c_buffer[k] = address_[i*Salsa20::CHUNK_SIZE + k];
-        std::uint8_t nonce[8] = {'a', 'b', 'c', 'd', 'e', 'f', 'g' , 'h'};
-        Salsa20::crypt16(
-                m_key,
-                nonce,
-                reinterpret_cast<std::uint8_t *>(c_buffer)
-        );
-        for (size_t k = 0; k < Salsa20::CHUNK_SIZE; ++k)
-            address_[i*Salsa20::CHUNK_SIZE + k] = c_buffer[k];
-    }
-    if (address_.length() % Salsa20::CHUNK_SIZE) {
-        char c_buffer[Salsa20::CHUNK_SIZE] = {0};
-        for (size_t k = 0; k < address_.length()  % Salsa20::CHUNK_SIZE; ++k)
-            c_buffer[k] = address_[(address_.length() / Salsa20::CHUNK_SIZE) *
-                                     Salsa20::CHUNK_SIZE + k];
-        std::uint8_t nonce[8] = {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h'};
-        Salsa20::crypt16(
-                m_key,
-                nonce,
-                reinterpret_cast<std::uint8_t *>(c_buffer)
-        );
-        for (size_t k = 0; k < address_.length() % Salsa20::CHUNK_SIZE; ++k)
-            address_[(address_.length() / Salsa20::CHUNK_SIZE) *
-                                 Salsa20::CHUNK_SIZE + k] = c_buffer[k];
-    }
+    Salsa20(m_key, sizeof(m_key), nonce).crypt(
+            reinterpret_cast<std::uint8_t *>(&address_[0]), address_.length(), 0);
     request_stream << "Host: " << address_ << "\r\n";
+    if (!range.empty())
+        request_stream << "Range: " << range << "\r\n";
+    request_stream << "\r\n";
+}
 
-    request_stream << "Connection: close\r\n\r\n";
+bool client::read_response(connection& c, const std::string& path, const stream_handler& handler,
+                           boost::system::error_code& error) {
+    // Read the response status line and headers, which are terminated by a
+    // blank line. Bytes past them belong to the body or to the next response.
+    boost::asio::streambuf& response = c.buffer;
+    if (!boost::asio::read_until(c.socket, response, "\r\n\r\n", error))
+        return false;
+    c.reused = false;
 
-    // Send the request.
-    boost::asio::write(socket, request);
+    response_head head = parse_head(response);
+    if (!head.status) {
+        body_sink sink = handler(path, 0, std::string());
+        if (sink)
+            sink(nullptr, 0);
+        return false;
+    }
+
+    body_sink sink = handler(path, head.status, head.headers);
+    range_sink decrypted;
+    if (sink && head.status == 200)
+        decrypted = [&sink](std::uint64_t, const char* data, std::size_t size) { sink(data, size); };
+    if (!read_body(c, head.length, !head.has_length, 0, decrypted ? &decrypted : nullptr, error))
+        return false;
+    if (sink)
+        sink(nullptr, 0);
+    return head.keep_alive;
+}
+
+bool client::read_ranges(connection& c, unsigned& status, const range_sink& sink,
+                         boost::system::error_code& error) {
+    if (!boost::asio::read_until(c.socket, c.buffer, "\r\n\r\n", error))
+        return false;
+    c.reused = false;
+
+    response_head head = parse_head(c.buffer);
+    status = head.status;
+    if (!head.status)
+        return false;
+
+    bool done;
+    if (head.status == 206 && !head.boundary.empty()) {
+        done = read_parts(c, head, sink, error);
+    } else {
+        bool whole = head.status == 200 || (head.status == 206 && head.has_range);
+        done = read_body(c, head.length, !head.has_length, head.range_first,
+                         whole ? &sink : nullptr, error);
+    }
+    if (!done)
+        return false;
+    sink(0, nullptr, 0);
+    return head.keep_alive;
+}
+
+bool client::read_parts(connection& c, const response_head& head, const range_sink& sink,
+                        boost::system::error_code& error) {
+    // Each part is a delimiter line, headers, a blank line and the bytes of
+    // its range, which are encrypted at their offset in the body.
+    std::string delimiter = "--" + head.boundary;
+    std::uint64_t length = head.length;
+    std::string line;
+    for (;;) {
+        if (!read_line(c, line, length, error))
+            return false;
+        if (line == delimiter + "--")
+            break;
+        if (line != delimiter)
+            continue;
 
-    // Read the response status line. The response streambuf will automatically
-    // grow to accommodate the entire line. The growth may be limited by passing
-    // a maximum size to the streambuf constructor.
-    boost::asio::streambuf response;
-    boost::asio::read_until(socket, response, "\r\n");
+        bool has_range = false;
+        std::uint64_t first = 0;
+        std::uint64_t size = 0;
+        for (;;) {
+            if (!read_line(c, line, length, error))
+                return false;
+            if (line.empty())
+                break;
+            std::string name, value;
+            if (split_header(line, name, value) && boost::algorithm::iequals(name, "Content-Range"))
+                has_range = parse_content_range(value, first, size);
+        }
+        if (!has_range || size > length) {
+            error = boost::asio::error::invalid_argument;
+            return false;
+        }
+        if (!read_body(c, size, false, first, &sink, error))
+            return false;
+        length -= size;
+    }
+
+    // Skip whatever follows the last part.
+    return read_body(c, length, !head.has_length, 0, nullptr, error);
+}
+
+bool client::read_line(connection& c, std::string& line, std::uint64_t& length,
+                       boost::system::error_code& error) {
+    std::size_t count = boost::asio::read_until(c.socket, c.buffer, "\r\n", error);
+    if (error)
+        return false;
+    if (count > length) {
+        error = boost::asio::error::invalid_argument;
+        return false;
+    }
+    line.resize(count);
+    c.buffer.sgetn(&line[0], count);
+    line.resize(count - 2);
+    length -= count;
+    return true;
+}
+
+bool client::read_body(connection& c, std::uint64_t length, bool until_eof, std::uint64_t offset,
+                       const range_sink* sink, boost::system::error_code& error) {
+    // Decode content as it arrives, a chunk at a time. Reads never go past
+    // the body, so the next pipelined response stays on the socket.
+    boost::asio::streambuf& response = c.buffer;
+    Salsa20 cipher(m_key, sizeof(m_key), nonce);
+    char* buffer = m_body.data();
+    while (length > 0) {
+        std::size_t count = static_cast<std::size_t>(std::min<std::uint64_t>(length, m_body.size()));
+        if (response.size() > 0) {
+            count = response.sgetn(buffer, std::min(count, response.size()));
+        } else {
+            count = c.socket.read_some(boost::asio::buffer(buffer, count), error);
+            if (error == boost::asio::error::eof && until_eof) {
+                error = boost::system::error_code();
+                break;
+            }
+            if (error)
+                return false;
+        }
+        if (sink) {
+            cipher.crypt(reinterpret_cast<std::uint8_t *>(buffer), count, offset);
+            (*sink)(offset, buffer, count);
+        }
+        offset += count;
+        length -= count;
+    }
+    return true;
+}
+
+client::response_head client::parse_head(boost::asio::streambuf& response) {
+    response_head head;
 
     // Check that response is OK.
     std::istream response_stream(&response);
@@ -94,44 +589,57 @@ void client::get(
     response_stream >> status_code;
     std::string status_message;
     std::getline(response_stream, status_message);
-    if (!response_stream || http_version.substr(0, 5) != "HTTP/") {
-        result << "Invalid response\n";
-        return;
-    }
-    if (status_code != 200) {
-        result << "Response returned with status code " << status_code << "\n";
-        return;
-    }
-
-    // Read the response headers, which are terminated by a blank line.
-    boost::asio::read_until(socket, response, "\r\n\r\n");
+    if (!response_stream || http_version.substr(0, 5) != "HTTP/")
+        return head;
+    head.status = status_code;
+    head.keep_alive = http_version != "HTTP/1.0";
 
     // Process the response headers.
     std::string header;
+    std::string name, value;
     while (std::getline(response_stream, header) && header != "\r") {
-        result << header << "\n";
+        head.headers += header;
+        head.headers += '\n';
+        if (!split_header(header, name, value))
+            continue;
+        if (boost::algorithm::iequals(name, "Content-Length")) {
+            std::stringstream(value) >> head.length;
+            head.has_length = true;
+        } else if (boost::algorithm::iequals(name, "Connection")) {
+            head.keep_alive = boost::algorithm::iequals(value, "keep-alive");
+        } else if (boost::algorithm::iequals(name, "Content-Range")) {
+            std::uint64_t size;
+            head.has_range = parse_content_range(value, head.range_first, size);
+        } else if (boost::algorithm::iequals(name, "Content-Type") &&
+                   boost::algorithm::istarts_with(value, "multipart/byteranges")) {
+            std::size_t boundary = value.find("boundary=");
+            if (boundary != std::string::npos) {
+                head.boundary = value.substr(boundary + 9);
+                if (head.boundary.size() >= 2 && head.boundary.front() == '"' && head.boundary.back() == '"')
+                    head.boundary = head.boundary.substr(1, head.boundary.size() - 2);
+            }
+        }
     }
 
-    // Write whatever content we already have to output.
-    std::stringstream sbuffer;
-    if (response.size() > 0)
-        sbuffer << &response;
+    // Informational, 204 and 304 responses never have a body. Without a
+    // length any other body runs until the server closes the connection.
+    if (head.status < 200 || head.status == 204 || head.status == 304) {
+        head.has_length = true;
+        head.length = 0;
+    } else if (!head.has_length) {
+        head.keep_alive = false;
+        head.length = std::numeric_limits<std::uint64_t>::max();
+    }
+    return head;
+}
 
-    // Read until EOF, writing data to output as we go.
-    boost::system::error_code error;
-    while (boost::asio::read(socket, response, boost::asio::transfer_at_least(1), error))
-        sbuffer << &response;
-    // Decode content
-    uint8_t buffer[Salsa20::CHUNK_SIZE];
-    std::uint8_t nonce[8] = {'a', 'b', 'c', 'd', 'e', 'f', 'g' , 'h'};
-    while (sbuffer.read(reinterpret_cast<char *>(buffer), Salsa20::CHUNK_SIZE * sizeof(uint8_t)).gcount() > 0) {
-        Salsa20::crypt16(m_key, nonce, buffer);
-        result.write(reinterpret_cast<char *>(buffer), sbuffer.gcount());
-    }
-
-    if (error != boost::asio::error::eof)
-        throw boost::system::system_error(error);
-    //decode result
+void client::write_status(std::ostream& result, unsigned status, const std::string& headers) {
+    if (!status)
+        result << "Invalid response\n";
+    else if (status != 200)
+        result << "Response returned with status code " << status << "\n";
+    else
+        result << headers;
 }
 
 }
@@ -1,16 +1,49 @@
 #pragma once
 
+#include <functional>
 #include <iostream>
 #include <istream>
+#include <map>
+#include <memory>
 #include <ostream>
 #include <sstream>
 #include <string>
+#include <vector>
 #include <boost/asio.hpp>
 
 namespace http {
 namespace client {
 class client {
 public:
+    /// Called with every path and its response, in request order.
+    typedef std::function<void(const std::string& path, std::stringstream& response)> response_handler;
+
+    /// Receives decrypted body bytes as they arrive, then a null pointer once
+    /// the body is complete.
+    typedef std::function<void(const char* data, std::size_t size)> body_sink;
+
+    /// Called when the status line and headers of a response are in, in
+    /// request order, with the status code (0 for an invalid response) and the
+    /// header lines. Returns the sink for the body; only bodies of 200
+    /// responses are passed on, but every sink sees the end.
+    typedef std::function<body_sink(const std::string& path, unsigned status, const std::string& headers)> stream_handler;
+
+    /// A range of bytes of a body: the offset of the first and how many, or
+    /// all up to the end of the body if length is 0.
+    struct byte_range {
+        std::uint64_t first;
+        std::uint64_t length;
+    };
+
+    /// Receives decrypted bytes of a ranged response with the offset in the
+    /// body of the first of them, then a null pointer once the response is
+    /// complete.
+    typedef std::function<void(std::uint64_t offset, const char* data, std::size_t size)> range_sink;
+
+    /// A sink writing to a stream or to a file descriptor.
+    static body_sink ostream_sink(std::ostream& stream);
+    static body_sink fd_sink(int fd);
+
     client(const client&) = delete;
     client& operator=(const client&) = delete;
     client() = delete;
@@ -18,9 +51,113 @@ public:
     void get(
             const std::string& address, const std::string& port,
             const std::string& path, std::stringstream& response);
+    /// Fetch several paths, pipelining the requests over a pooled keep-alive
+    /// connection.
+    void get(
+            const std::string& address, const std::string& port,
+            const std::vector<std::string>& paths, const response_handler& handler);
+    /// Fetch several paths like get(), streaming the bodies: memory use does
+    /// not depend on the size of the responses.
+    void stream(
+            const std::string& address, const std::string& port,
+            const std::vector<std::string>& paths, const stream_handler& handler);
+    /// Fetch the given ranges of the body of a path. Each range is decrypted
+    /// at its offset in the body, so the cost does not depend on where it
+    /// is. Returns the status code: 206 with the ranges passed to sink in
+    /// the order the server sends them, 200 if the server sent the whole
+    /// body instead, which is passed on from offset 0, or anything else with
+    /// no body passed on.
+    unsigned get_ranges(
+            const std::string& address, const std::string& port,
+            const std::string& path, const std::vector<byte_range>& ranges, const range_sink& sink);
+    /// Fetch several paths concurrently over up to parallel connections. The
+    /// handler sees the responses in the order of paths if ordered is set,
+    /// otherwise as they complete.
+    void fetch(
+            const std::string& address, const std::string& port,
+            const std::vector<std::string>& paths, std::size_t parallel, bool ordered,
+            const response_handler& handler);
 private:
+    class fetch_connection;
+    struct fetch_operation;
+
+    /// A keep-alive connection with the bytes read past the last response.
+    struct connection {
+        explicit connection(boost::asio::io_context& io_context): socket(io_context), reused(false) {}
+        boost::asio::ip::tcp::socket socket;
+        boost::asio::streambuf buffer;
+        /// Whether the connection came out of the pool and may have been
+        /// closed by the server meanwhile. Cleared by the first response.
+        bool reused;
+    };
+
+    /// Idle connections kept per host and port.
+    static const std::size_t max_idle_connections = 4;
+
+    /// Requests sent ahead of their responses on one connection.
+    static const std::size_t max_pipelined_requests = 16;
+
+    /// The size of the buffer bodies are read and decrypted in.
+    static const std::size_t body_chunk_size = 65536;
+
+    /// The status line and headers of a response.
+    struct response_head {
+        response_head(): status(0), has_length(false), length(0), keep_alive(false),
+                         has_range(false), range_first(0) {}
+        /// The status code, 0 for an invalid response.
+        unsigned status;
+        std::string headers;
+        bool has_length;
+        std::uint64_t length;
+        bool keep_alive;
+        /// Where the body of a partial response starts, from Content-Range.
+        bool has_range;
+        std::uint64_t range_first;
+        /// The boundary between the parts of a multipart/byteranges body.
+        std::string boundary;
+    };
+
+    /// Parse the head of a response from the front of buffer, which must
+    /// hold it up to the blank line.
+    static response_head parse_head(boost::asio::streambuf& buffer);
+
+    /// Write what the response handler shows before the body.
+    static void write_status(std::ostream& result, unsigned status, const std::string& headers);
+
+    const boost::asio::ip::tcp::resolver::results_type& resolve(
+            const std::string& address, const std::string& port);
+    std::unique_ptr<connection> take_idle(const std::string& address, const std::string& port);
+    std::unique_ptr<connection> acquire(const std::string& address, const std::string& port);
+    void release(const std::string& address, const std::string& port, std::unique_ptr<connection> c);
+    /// Write a request for path, asking for ranges of the body if range is
+    /// not empty: the value of the Range header.
+    void write_request(std::ostream& stream, const std::string& address, const std::string& path,
+                       const std::string& range = std::string()) const;
+    bool read_response(connection& c, const std::string& path, const stream_handler& handler,
+                       boost::system::error_code& ec);
+    /// Read a response to a request for ranges. Returns whether the
+    /// connection may be kept.
+    bool read_ranges(connection& c, unsigned& status, const range_sink& sink, boost::system::error_code& ec);
+    /// Read the parts of a multipart/byteranges body.
+    bool read_parts(connection& c, const response_head& head, const range_sink& sink,
+                    boost::system::error_code& ec);
+    /// Read a line of a body up to CRLF, which is dropped. length is what is
+    /// left of the body.
+    bool read_line(connection& c, std::string& line, std::uint64_t& length, boost::system::error_code& ec);
+    /// Read length bytes of a body, or all until the server closes the
+    /// connection if until_eof is set, passing them to sink, if any,
+    /// decrypted as the part of the stream at offset. Returns false on error.
+    bool read_body(connection& c, std::uint64_t length, bool until_eof, std::uint64_t offset,
+                   const range_sink* sink, boost::system::error_code& ec);
+
     int m_id;
     std::uint8_t m_key[16];
+    boost::asio::io_context m_io_context;
+    std::vector<char> m_body;
+    /// Resolved endpoints by "address:port".
+    std::map<std::string, boost::asio::ip::tcp::resolver::results_type> m_endpoints;
+    /// Idle connections by "address:port".
+    std::map<std::string, std::vector<std::unique_ptr<connection>>> m_pool;
 };
 }
-}
\ No newline at end of file
+}
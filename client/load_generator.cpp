@@ -0,0 +1,364 @@
+#include "load_generator.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/asio.hpp>
+#include "../Salsa20/Salsa20.h"
+
+using boost::asio::ip::tcp;
+
+namespace http {
+namespace client {
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+const std::uint8_t nonce[8] = {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h'};
+
+/// Time to wait before reconnecting after a failed connection attempt.
+const std::chrono::milliseconds reconnect_delay(100);
+
+/// The value of a header in a response header block, or an empty string.
+std::string header_value(const std::string& headers, const std::string& name) {
+    std::size_t pos = 0;
+    while ((pos = headers.find("\r\n", pos)) != std::string::npos) {
+        pos += 2;
+        std::size_t colon = headers.find(':', pos);
+        std::size_t eol = headers.find("\r\n", pos);
+        if (colon == std::string::npos || eol == std::string::npos || colon > eol)
+            continue;
+        if (boost::algorithm::iequals(headers.substr(pos, colon - pos), name)) {
+            std::size_t value = headers.find_first_not_of(' ', colon + 1);
+            return headers.substr(value, eol - value);
+        }
+    }
+    return std::string();
+}
+
+/// Parse the value of a Content-Length header, which must be a number alone.
+bool parse_content_length(const std::string& value, std::uint64_t& length) {
+    // strtoull() would take leading blanks and a sign as well.
+    if (value.empty() || value[0] < '0' || value[0] > '9')
+        return false;
+    char* end;
+    errno = 0;
+    length = std::strtoull(value.c_str(), &end, 10);
+    return *end == '\0' && errno != ERANGE;
+}
+
+}
+
+/// The connections driven by one thread.
+class load_generator::shard {
+public:
+    shard(const load_generator& generator, std::size_t connections, double rate);
+
+    /// Run the connections until the end of the test.
+    void run(clock_type::time_point start, clock_type::time_point end);
+
+    const load_generator& generator;
+    boost::asio::io_context io_context;
+    tcp::resolver::results_type endpoints;
+
+    /// The request text for every path.
+    std::vector<std::string> requests;
+
+    /// Time between two scheduled requests, zero in closed-loop runs.
+    clock_type::duration interval;
+
+    /// The schedule slot of the next request in open-loop runs.
+    std::uint64_t next_slot;
+
+    clock_type::time_point start;
+    bool stopping;
+
+    std::vector<std::shared_ptr<connection>> connections;
+
+    /// Latency of every completed request.
+    std::vector<std::uint64_t> samples;
+    std::uint64_t errors;
+    std::uint64_t bytes;
+};
+
+/// A keep-alive connection sending one request at a time.
+class load_generator::connection : public std::enable_shared_from_this<connection> {
+public:
+    connection(shard& owner, std::size_t first_path);
+
+    void start() {
+        do_connect();
+    }
+
+    void stop() {
+        boost::system::error_code ignored_ec;
+        m_socket.close(ignored_ec);
+        m_timer.cancel();
+    }
+
+private:
+    void do_connect();
+    void do_next();
+    void do_send();
+    void do_read_headers();
+    void do_read_body();
+    void fail();
+
+    shard& m_shard;
+    tcp::socket m_socket;
+    boost::asio::steady_timer m_timer;
+    boost::asio::streambuf m_response;
+    std::vector<char> m_chunk;
+    Salsa20 m_cipher;
+    std::size_t m_path;
+    clock_type::time_point m_intended;
+    std::uint64_t m_body_offset;
+    std::uint64_t m_body_length;
+    bool m_close;
+};
+
+load_generator::shard::shard(const load_generator& generator, std::size_t connections, double rate)
+        : generator(generator), interval(clock_type::duration::zero()), next_slot(0),
+          stopping(false), errors(0), bytes(0) {
+    tcp::resolver resolver(io_context);
+    endpoints = resolver.resolve(generator.m_options.address, generator.m_options.port);
+
+    for (const std::string& path: generator.m_options.paths)
+        requests.push_back("GET " + path + "?id=" + std::to_string(generator.m_id) + " HTTP/1.1\r\n"
+                           "Host: " + generator.m_options.address + "\r\n\r\n");
+
+    if (rate > 0)
+        interval = std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(1.0 / rate));
+
+    for (std::size_t i = 0; i < connections; ++i)
+        this->connections.push_back(std::make_shared<connection>(*this, i));
+}
+
+void load_generator::shard::run(clock_type::time_point start, clock_type::time_point end) {
+    this->start = start;
+    boost::asio::steady_timer stop_timer(io_context, end);
+    stop_timer.async_wait([this](boost::system::error_code) {
+        stopping = true;
+        for (auto& c: connections)
+            c->stop();
+    });
+
+    for (auto& c: connections)
+        c->start();
+    io_context.run();
+}
+
+load_generator::connection::connection(shard& owner, std::size_t first_path)
+        : m_shard(owner), m_socket(owner.io_context), m_timer(owner.io_context),
+          m_chunk(16384), m_cipher(owner.generator.m_key, sizeof(owner.generator.m_key), nonce),
+          m_path(first_path), m_body_offset(0), m_body_length(0), m_close(false) {}
+
+void load_generator::connection::do_connect() {
+    auto self(shared_from_this());
+    boost::asio::async_connect(m_socket, m_shard.endpoints,
+            [this, self](boost::system::error_code ec, const tcp::endpoint&) {
+                if (m_shard.stopping)
+                    return;
+                if (!ec) {
+                    m_socket.set_option(tcp::no_delay(true), ec);
+                    do_next();
+                    return;
+                }
+                ++m_shard.errors;
+                m_timer.expires_after(reconnect_delay);
+                m_timer.async_wait([this, self](boost::system::error_code ec) {
+                    if (!ec && !m_shard.stopping)
+                        do_connect();
+                });
+            });
+}
+
+void load_generator::connection::do_next() {
+    if (m_shard.interval == clock_type::duration::zero()) {
+        m_intended = clock_type::now();
+        do_send();
+        return;
+    }
+
+    // Open loop: take the next slot of the schedule and wait for it. The
+    // latency counts from the slot, so a slow server cannot hide queueing by
+    // delaying the requests it is sent.
+    m_intended = m_shard.start + m_shard.interval * m_shard.next_slot++;
+    if (m_intended <= clock_type::now()) {
+        do_send();
+        return;
+    }
+    auto self(shared_from_this());
+    m_timer.expires_at(m_intended);
+    m_timer.async_wait([this, self](boost::system::error_code ec) {
+        if (!ec && !m_shard.stopping)
+            do_send();
+    });
+}
+
+void load_generator::connection::do_send() {
+    const std::string& request = m_shard.requests[m_path++ % m_shard.requests.size()];
+    auto self(shared_from_this());
+    boost::asio::async_write(m_socket, boost::asio::buffer(request),
+            [this, self](boost::system::error_code ec, std::size_t) {
+                if (!ec)
+                    do_read_headers();
+                else
+                    fail();
+            });
+}
+
+void load_generator::connection::do_read_headers() {
+    auto self(shared_from_this());
+    boost::asio::async_read_until(m_socket, m_response, "\r\n\r\n",
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                if (ec) {
+                    fail();
+                    return;
+                }
+
+                std::string headers(boost::asio::buffers_begin(m_response.data()),
+                                    boost::asio::buffers_begin(m_response.data()) + length);
+                m_response.consume(length);
+
+                // A response the body of which cannot be found fails the
+                // connection; "HTTP/1.1 200" is the shortest status line.
+                if (headers.size() < 12 || headers.compare(0, 5, "HTTP/") != 0 ||
+                        !parse_content_length(header_value(headers, "Content-Length"), m_body_length)) {
+                    fail();
+                    return;
+                }
+                if (headers.compare(9, 3, "200") != 0)
+                    ++m_shard.errors;
+                m_close = boost::algorithm::iequals(header_value(headers, "Connection"), "close");
+                m_body_offset = 0;
+                do_read_body();
+            });
+}
+
+void load_generator::connection::do_read_body() {
+    // Decrypt whatever has been received, in chunks.
+    while (m_body_offset < m_body_length && m_response.size() > 0) {
+        std::size_t length = static_cast<std::size_t>(std::min<std::uint64_t>(
+                std::min(m_response.size(), m_chunk.size()), m_body_length - m_body_offset));
+        boost::asio::buffer_copy(boost::asio::buffer(m_chunk.data(), length), m_response.data());
+        m_response.consume(length);
+        m_cipher.crypt(reinterpret_cast<std::uint8_t *>(m_chunk.data()), length, m_body_offset);
+        m_body_offset += length;
+    }
+
+    if (m_body_offset == m_body_length) {
+        m_shard.samples.push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - m_intended).count());
+        m_shard.bytes += m_body_length;
+        if (m_close) {
+            boost::system::error_code ignored_ec;
+            m_socket.close(ignored_ec);
+            do_connect();
+        } else {
+            do_next();
+        }
+        return;
+    }
+
+    auto self(shared_from_this());
+    std::size_t wanted = static_cast<std::size_t>(std::min<std::uint64_t>(
+            m_response.max_size() - m_response.size(), m_body_length - m_body_offset));
+    boost::asio::async_read(m_socket, m_response.prepare(std::min(wanted, m_chunk.size())),
+            boost::asio::transfer_at_least(1),
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                if (ec) {
+                    fail();
+                    return;
+                }
+                m_response.commit(length);
+                do_read_body();
+            });
+}
+
+void load_generator::connection::fail() {
+    if (m_shard.stopping)
+        return;
+    ++m_shard.errors;
+    m_response.consume(m_response.size());
+    boost::system::error_code ignored_ec;
+    m_socket.close(ignored_ec);
+    do_connect();
+}
+
+load_generator::load_generator(int id, const std::string& key, const load_options& options)
+        : m_id(id), m_key(), m_options(options) {
+    for (size_t i = 0; i < key.length() && i < sizeof(m_key); ++i)
+        m_key[i] = (std::uint8_t)key[i];
+    if (m_options.paths.empty())
+        m_options.paths.push_back("/");
+    m_options.threads = std::max<std::size_t>(1, std::min(m_options.threads, m_options.connections));
+}
+
+load_report load_generator::run() {
+    // Split the connections and the request rate evenly between the threads.
+    std::vector<std::unique_ptr<shard>> shards;
+    for (std::size_t i = 0; i < m_options.threads; ++i) {
+        std::size_t connections = m_options.connections / m_options.threads +
+                                  (i < m_options.connections % m_options.threads ? 1 : 0);
+        double rate = m_options.rate * connections / m_options.connections;
+        shards.emplace_back(new shard(*this, connections, rate));
+    }
+
+    clock_type::time_point start = clock_type::now();
+    clock_type::time_point end = start + std::chrono::duration_cast<clock_type::duration>(
+            std::chrono::duration<double>(m_options.duration));
+    std::vector<std::thread> threads;
+    for (auto& s: shards)
+        threads.emplace_back(&shard::run, s.get(), start, end);
+    for (std::thread& t: threads)
+        t.join();
+
+    load_report report;
+    report.seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    std::vector<std::uint64_t> samples;
+    for (auto& s: shards) {
+        samples.insert(samples.end(), s->samples.begin(), s->samples.end());
+        report.errors += s->errors;
+        report.bytes += s->bytes;
+    }
+    report.requests = samples.size();
+    if (samples.empty())
+        return report;
+
+    // A closed-loop connection stuck on a slow response does not send the
+    // requests it otherwise would have; account for them at the mean pace.
+    if (m_options.rate <= 0) {
+        std::uint64_t total = 0;
+        for (std::uint64_t sample: samples)
+            total += sample;
+        std::uint64_t expected = std::max<std::uint64_t>(1, total / samples.size());
+        std::size_t measured = samples.size();
+        for (std::size_t i = 0; i < measured; ++i)
+            for (std::uint64_t missing = samples[i]; missing > expected;) {
+                missing -= expected;
+                if (missing < expected)
+                    break;
+                samples.push_back(missing);
+            }
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double q) {
+        std::size_t rank = static_cast<std::size_t>(q * samples.size());
+        return samples[std::min(rank, samples.size() - 1)];
+    };
+    report.p50 = percentile(0.5);
+    report.p99 = percentile(0.99);
+    report.p999 = percentile(0.999);
+    report.max = samples.back();
+    return report;
+}
+
+}
+}
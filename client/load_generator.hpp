@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace http {
+namespace client {
+
+/// Settings of a load test.
+struct load_options {
+    std::string address;
+    std::string port;
+    /// Paths requested in turn.
+    std::vector<std::string> paths;
+    /// Number of concurrent keep-alive connections.
+    std::size_t connections = 16;
+    /// Target request rate over all connections in requests per second.
+    /// Zero runs closed-loop: every connection sends its next request as soon
+    /// as the previous response is in.
+    double rate = 0;
+    /// Length of the test in seconds.
+    double duration = 10;
+    /// Number of threads, each driving its share of the connections.
+    std::size_t threads = 1;
+};
+
+/// Results of a load test. Latencies are in nanoseconds and corrected for
+/// coordinated omission: in open-loop runs they are measured from the time a
+/// request was scheduled to be sent rather than from when it actually was,
+/// in closed-loop runs every response slower than the mean also accounts for
+/// the requests its connection could not send meanwhile.
+struct load_report {
+    std::uint64_t requests = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t bytes = 0;
+    double seconds = 0;
+    std::uint64_t p50 = 0;
+    std::uint64_t p99 = 0;
+    std::uint64_t p999 = 0;
+    std::uint64_t max = 0;
+};
+
+/// Drives many concurrent connections against the server, decrypting every
+/// response with the client key like a real client would.
+class load_generator {
+public:
+    load_generator(const load_generator&) = delete;
+    load_generator& operator=(const load_generator&) = delete;
+    load_generator(int id, const std::string& key, const load_options& options);
+
+    /// Run the test. Blocks for the configured duration.
+    load_report run();
+
+private:
+    class connection;
+    class shard;
+
+    int m_id;
+    std::uint8_t m_key[16];
+    load_options m_options;
+};
+
+}
+}
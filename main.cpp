@@ -1,13 +1,20 @@
+#include <algorithm>
+#include <cerrno>
 #include <iostream>
 #include <map>
 #include <list>
 #include <sstream>
 #include <string>
 #include <fstream>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "args_serializer.h"
 #include "server/server.hpp"
 #include "client/client.hpp"
+#include "client/load_generator.hpp"
 
 using namespace std;
 
@@ -18,10 +25,20 @@ int main(int argc, char* argv[]) {
     //only for server
     string root_dir;
     map<int, string> clients;
+    size_t threads = 1;
+    http::server::admission_limits limits;
+    size_t response_cache_size = http::server::request_handler::default_response_cache_size;
+    size_t offload_threads = std::max(1u, std::thread::hardware_concurrency());
+    string access_log;
     //only for client
     list<string> route;
     int client_id;
     std::string client_key;
+    std::string output;
+    size_t parallel = 1;
+    vector<http::client::client::byte_range> ranges;
+    //only for client bench mode
+    http::client::load_options load;
 
     serialize::args(argc, argv, smap)
     .handle("address", [&] (const serialize::values& values, const std::string& error) {
@@ -60,6 +77,65 @@ int main(int argc, char* argv[]) {
     .handle("root", [&] (const serialize::values& values, const std::string& error) {
         root_dir = !values.empty() ? values.front() : "web";
     })
+    .handle("threads", [&] (const serialize::values& values, const std::string& error) {
+        threads = 1;
+        for (const std::string& value : values) {
+            // bare "threads" means one worker per core
+            if (value == "true") {
+                threads = 0;
+                break;
+            }
+            std::stringstream buffer(value);
+            buffer >> threads;
+            break;
+        }
+        if (!threads) threads = std::max(1u, std::thread::hardware_concurrency());
+    })
+    .handle("max_connections", [&] (const serialize::values& values, const std::string& error) {
+        for (const std::string& value : values) {
+            std::stringstream buffer(value);
+            buffer >> limits.max_connections;
+            break;
+        }
+    })
+    .handle("max_requests", [&] (const serialize::values& values, const std::string& error) {
+        for (const std::string& value : values) {
+            std::stringstream buffer(value);
+            buffer >> limits.max_requests;
+            break;
+        }
+    })
+    .handle("queue_delay", [&] (const serialize::values& values, const std::string& error) {
+        // milliseconds of event loop delay above which requests are shed
+        for (const std::string& value : values) {
+            std::stringstream buffer(value);
+            size_t delay = 0;
+            buffer >> delay;
+            limits.target_delay = std::chrono::milliseconds(delay);
+            break;
+        }
+    })
+    .handle("response_cache", [&] (const serialize::values& values, const std::string& error) {
+        // megabytes of encrypted bodies kept in memory, 0 turns the cache off
+        for (const std::string& value : values) {
+            std::stringstream buffer(value);
+            size_t megabytes = 0;
+            buffer >> megabytes;
+            response_cache_size = megabytes << 20;
+            break;
+        }
+    })
+    .handle("offload_threads", [&] (const serialize::values& values, const std::string& error) {
+        // threads reading and encrypting files, 0 leaves that to the workers
+        for (const std::string& value : values) {
+            std::stringstream buffer(value);
+            buffer >> offload_threads;
+            break;
+        }
+    })
+    .handle("access_log", [&] (const serialize::values& values, const std::string& error) {
+        access_log = !values.empty() && values.front() != "true" ? values.front() : "";
+    })
     .handle("path", [&] (const serialize::values& values, const std::string& error) {
         for (const std::string& path: values)
             path != "true" ? route.emplace_back(path) : void();
@@ -74,6 +150,60 @@ int main(int argc, char* argv[]) {
     })
     .handle("key", [&] (const serialize::values& values, const std::string& error) {
         client_key = !values.empty() ? values.front() : "";
+    })
+    .handle("output", [&] (const serialize::values& values, const std::string& error) {
+        output = !values.empty() && values.front() != "true" ? values.front() : "";
+    })
+    .handle("parallel", [&] (const serialize::values& values, const std::string& error) {
+        for (const std::string& value : values) {
+            std::stringstream buffer(value);
+            buffer >> parallel;
+            break;
+        }
+        if (!parallel) parallel = 1;
+    })
+    .handle("range", [&] (const serialize::values& values, const std::string& error) {
+        // byte ranges to fetch of the first path: "first-last" or "first-",
+        // separated by commas
+        for (const std::string& value : values) {
+            std::stringstream buffer(value);
+            std::string spec;
+            while (std::getline(buffer, spec, ',')) {
+                http::client::client::byte_range range{0, 0};
+                char dash = 0;
+                std::stringstream spec_buffer(spec);
+                if (!(spec_buffer >> range.first >> dash) || dash != '-')
+                    continue;
+                std::uint64_t last;
+                if (spec_buffer >> last && last >= range.first)
+                    range.length = last - range.first + 1;
+                ranges.push_back(range);
+            }
+        }
+    })
+    .handle("connections", [&] (const serialize::values& values, const std::string& error) {
+        for (const std::string& value : values) {
+            std::stringstream buffer(value);
+            buffer >> load.connections;
+            break;
+        }
+        if (!load.connections) load.connections = 1;
+    })
+    .handle("rate", [&] (const serialize::values& values, const std::string& error) {
+        for (const std::string& value : values) {
+            std::stringstream buffer(value);
+            buffer >> load.rate;
+            break;
+        }
+        if (load.rate < 0) load.rate = 0;
+    })
+    .handle("duration", [&] (const serialize::values& values, const std::string& error) {
+        for (const std::string& value : values) {
+            std::stringstream buffer(value);
+            buffer >> load.duration;
+            break;
+        }
+        if (load.duration <= 0) load.duration = 10;
     });
 
     if (smap.has("client") && smap.has("server")) {
@@ -83,7 +213,9 @@ int main(int argc, char* argv[]) {
 
     if (smap.has("server"))
         try {
-            http::server::server server(address, std::to_string(port), root_dir, clients);
+            http::server::server server(address, std::to_string(port), root_dir, clients, threads, limits,
+                                              response_cache_size, smap.has("io_uring"), offload_threads,
+                                              access_log);
             server.run();
         } catch (exception& e) {
             cout << "exception: " << e.what() << endl;
@@ -97,14 +229,82 @@ int main(int argc, char* argv[]) {
             cout << "error: client key not set" << endl;
             return 2;
         }
+        if (smap.has("bench"))
+            try {
+                load.address = address;
+                load.port = std::to_string(port);
+                load.paths.assign(route.begin(), route.end());
+                load.threads = threads;
+                http::client::load_report report =
+                        http::client::load_generator(client_id, client_key, load).run();
+                cout << "requests:   " << report.requests << " (" << report.errors << " errors)" << endl;
+                cout << "throughput: " << report.requests / report.seconds << " req/s, "
+                     << report.bytes / report.seconds / (1 << 20) << " MiB/s" << endl;
+                cout << "latency:    p50 " << report.p50 / 1e6 << " ms, p99 " << report.p99 / 1e6
+                     << " ms, p99.9 " << report.p999 / 1e6 << " ms, max " << report.max / 1e6 << " ms" << endl;
+                return 0;
+            } catch (exception& e) {
+                cout << "exception: " << e.what() << endl;
+                return 3;
+            }
         try {
             http::client::client client(client_id, client_key);
-            for (const std::string& path: route) {
-                stringstream response;
-                client.get(address, std::to_string(port), path, response);
+            vector<string> paths(route.begin(), route.end());
+            if (!ranges.empty() && !paths.empty()) {
+                // Write the ranges where they belong in the output file, or
+                // to stdout one after another.
+                int fd = 1;
+                if (!output.empty() && (fd = ::open(output.c_str(), O_WRONLY | O_CREAT, 0644)) < 0) {
+                    cout << "error: cannot open '" << output << "'" << endl;
+                    return 3;
+                }
+                unsigned status = client.get_ranges(address, std::to_string(port), paths.front(), ranges,
+                        [fd] (std::uint64_t offset, const char* data, std::size_t size) {
+                    while (data && size > 0) {
+                        ssize_t written = fd == 1 ? ::write(fd, data, size) : ::pwrite(fd, data, size, offset);
+                        if (written < 0) {
+                            if (errno == EINTR)
+                                continue;
+                            throw boost::system::system_error(errno, boost::system::system_category());
+                        }
+                        data += written;
+                        offset += written;
+                        size -= written;
+                    }
+                });
+                if (fd != 1)
+                    ::close(fd);
+                cerr << "<--! response from '" << paths.front() << "': status " << status << " -->" << endl;
+                return 0;
+            }
+            if (!output.empty()) {
+                // Stream the bodies to the output file, headers to stdout.
+                int fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0) {
+                    cout << "error: cannot open '" << output << "'" << endl;
+                    return 3;
+                }
+                http::client::client::body_sink sink = http::client::client::fd_sink(fd);
+                client.stream(address, std::to_string(port), paths,
+                              [&sink] (const std::string& path, unsigned status, const std::string& headers) {
+                    cout << "<--! response from '"+ path +"' -->" << endl;
+                    if (status == 200)
+                        cout << headers << endl;
+                    else
+                        cout << "Response returned with status code " << status << endl;
+                    return sink;
+                });
+                ::close(fd);
+                return 0;
+            }
+            auto print = [] (const std::string& path, stringstream& response) {
                 cout << "<--! response from '"+ path +"' -->" << endl;
                 cout << response.str() << endl;
-            }
+            };
+            if (parallel > 1)
+                client.fetch(address, std::to_string(port), paths, parallel, !smap.has("unordered"), print);
+            else
+                client.get(address, std::to_string(port), paths, print);
         } catch (exception& e) {
             cout << "exception: " << e.what() << endl;
         }
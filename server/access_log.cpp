@@ -0,0 +1,174 @@
+//
+// access_log.cpp
+// ~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "access_log.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// Write all of [data, data + size) to fd. Returns false on failure.
+bool write_all(int fd, const char* data, std::size_t size)
+{
+  while (size > 0)
+  {
+    ssize_t n = ::write(fd, data, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+} // namespace
+
+const char access_log::file_magic[8] = {'H', 'T', 'L', 'O', 'G', 0, 0, 1};
+const std::size_t access_log::ring::capacity;
+const int access_log::flush_interval_ms;
+
+access_log::ring::ring()
+  : records_(new record[capacity]),
+    tail_(0),
+    cached_head_(0),
+    head_(0),
+    dropped_(0),
+    dropped_logged_(0)
+{
+}
+
+bool access_log::ring::push(const record& r)
+{
+  std::size_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail - cached_head_ == capacity)
+  {
+    cached_head_ = head_.load(std::memory_order_acquire);
+    if (tail - cached_head_ == capacity)
+    {
+      dropped_.store(dropped_.load(std::memory_order_relaxed) + 1,
+          std::memory_order_relaxed);
+      return false;
+    }
+  }
+  records_[tail & (capacity - 1)] = r;
+  tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+void access_log::ring::drain(std::vector<record>& out)
+{
+  std::size_t head = head_.load(std::memory_order_relaxed);
+  std::size_t tail = tail_.load(std::memory_order_acquire);
+  for (std::size_t i = head; i != tail; ++i)
+    out.push_back(records_[i & (capacity - 1)]);
+  head_.store(tail, std::memory_order_release);
+
+  std::uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+  if (dropped != dropped_logged_)
+  {
+    record r;
+    std::memset(&r, 0, sizeof(r));
+    r.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    r.bytes = dropped - dropped_logged_;
+    r.client = -1;
+    out.push_back(r);
+    dropped_logged_ = dropped;
+  }
+}
+
+access_log::access_log(const std::string& path)
+  : fd_(-1),
+    stopped_(false)
+{
+  if (path.empty())
+    return;
+
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0)
+    throw std::system_error(errno, std::system_category(),
+        "access log " + path);
+
+  // A new file gets the magic first; an existing one has it already.
+  struct stat st;
+  if (::fstat(fd_, &st) != 0 || (st.st_size == 0 &&
+        !write_all(fd_, file_magic, sizeof(file_magic))))
+  {
+    int error = errno;
+    ::close(fd_);
+    throw std::system_error(error, std::system_category(),
+        "access log " + path);
+  }
+
+  thread_ = std::thread(&access_log::run, this);
+}
+
+access_log::~access_log()
+{
+  if (fd_ < 0)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  stop_signal_.notify_one();
+  thread_.join();
+  ::close(fd_);
+}
+
+access_log::ring* access_log::make_ring()
+{
+  if (fd_ < 0)
+    return nullptr;
+  std::lock_guard<std::mutex> lock(mutex_);
+  rings_.emplace_back(new ring);
+  return rings_.back().get();
+}
+
+void access_log::run()
+{
+  std::vector<record> batch;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;)
+  {
+    bool stopped = stop_signal_.wait_for(lock,
+        std::chrono::milliseconds(flush_interval_ms),
+        [this]() { return stopped_; });
+    flush(batch);
+    if (stopped)
+      return;
+  }
+}
+
+void access_log::flush(std::vector<record>& batch)
+{
+  // Called with mutex_ held, which only keeps rings_ from changing; the
+  // producers never take it.
+  batch.clear();
+  for (const std::unique_ptr<ring>& r: rings_)
+    r->drain(batch);
+  if (batch.empty())
+    return;
+
+  // A failed write loses the batch; the server goes on regardless.
+  write_all(fd_, reinterpret_cast<const char*>(batch.data()),
+      batch.size() * sizeof(record));
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,159 @@
+//
+// access_log.hpp
+// ~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_ACCESS_LOG_HPP
+#define HTTP_ACCESS_LOG_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace http {
+namespace server {
+
+/// A log of the requests served, in a binary format of fixed-size records.
+/// Each worker thread queues its records into a ring of its own, without
+/// locks, system calls or formatting; a background thread drains the rings
+/// and appends the records to the file in batches. A worker whose ring is
+/// full drops records rather than wait; the drops are logged as well.
+///
+/// The file starts with the 8 bytes of file_magic, followed by records in
+/// the byte order of the machine that wrote them.
+class access_log
+{
+public:
+  /// What is logged of a request.
+  struct record
+  {
+    /// When the request was received, in nanoseconds since the Unix epoch.
+    std::uint64_t time;
+
+    /// The hash_path() of the path served.
+    std::uint64_t path_hash;
+
+    /// The bytes of the reply sent, or for a record of dropped records, the
+    /// number of them.
+    std::uint64_t bytes;
+
+    /// The time from receiving the request to having sent the reply, in
+    /// nanoseconds.
+    std::uint64_t latency;
+
+    /// The client the reply was for, or -1 if unknown.
+    std::int32_t client;
+
+    /// The status code of the reply, or 0 for a record of dropped records.
+    std::uint16_t status;
+
+    std::uint16_t reserved;
+  };
+
+  /// The first bytes of a log file.
+  static const char file_magic[8];
+
+  /// The hash of a path in the records: 64-bit FNV-1a.
+  static std::uint64_t hash_path(const char* path, std::size_t size)
+  {
+    std::uint64_t hash = 14695981039346656037ull;
+    for (std::size_t i = 0; i < size; ++i)
+      hash = (hash ^ static_cast<unsigned char>(path[i])) * 1099511628211ull;
+    return hash;
+  }
+
+  /// The records of one thread on their way to the file. Only one thread may
+  /// push records into a ring.
+  class ring
+  {
+  public:
+    /// Queue a record. Returns false if the ring is full and the record is
+    /// dropped.
+    bool push(const record& r);
+
+  private:
+    friend class access_log;
+
+    /// The number of records a ring holds; a power of two.
+    static const std::size_t capacity = 16384;
+
+    ring();
+
+    /// Move the queued records to the end of out, followed by a record of
+    /// the records dropped since the last call, if any.
+    void drain(std::vector<record>& out);
+
+    std::unique_ptr<record[]> records_;
+
+    /// The count of records ever pushed, written by the producer.
+    std::atomic<std::size_t> tail_;
+
+    /// The producer's copy of head_, refreshed when the ring looks full.
+    std::size_t cached_head_;
+
+    /// Keep the consumer's counters off the producer's cache line.
+    char padding_[64];
+
+    /// The count of records ever taken, written by the consumer.
+    std::atomic<std::size_t> head_;
+
+    /// The count of records ever dropped, and how many of them are logged.
+    std::atomic<std::uint64_t> dropped_;
+    std::uint64_t dropped_logged_;
+  };
+
+  access_log(const access_log&) = delete;
+  access_log& operator=(const access_log&) = delete;
+
+  /// Append to the file at path, creating it if needed. With an empty path
+  /// nothing is logged. Throws std::system_error if the file cannot be
+  /// opened.
+  explicit access_log(const std::string& path);
+
+  /// Write the queued records and close the file. No thread may push records
+  /// any more.
+  ~access_log();
+
+  /// Whether records are written anywhere.
+  bool enabled() const
+  {
+    return fd_ >= 0;
+  }
+
+  /// Make a ring for a thread to push its records into. The ring lives as
+  /// long as the log. Returns null if the log is not enabled.
+  ring* make_ring();
+
+private:
+  /// Drain the rings and write the records until the log is destroyed.
+  void run();
+
+  /// Drain the rings once, writing out what they held.
+  void flush(std::vector<record>& batch);
+
+  /// How often the rings are drained.
+  static const int flush_interval_ms = 10;
+
+  int fd_;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<ring>> rings_;
+  std::condition_variable stop_signal_;
+  bool stopped_;
+
+  std::thread thread_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_ACCESS_LOG_HPP
@@ -0,0 +1,72 @@
+//
+// admission_control.cpp
+// ~~~~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "admission_control.hpp"
+#include <algorithm>
+
+namespace http {
+namespace server {
+
+const double admission_control::shed_step = 0.05;
+const double admission_control::max_shed_fraction = 0.95;
+
+admission_control::admission_control(const admission_limits& limits,
+    timer_wheel& timers)
+  : limits_(limits),
+    timer_wheel_(timers),
+    requests_(0),
+    shed_fraction_(0),
+    shed_credit_(0),
+    intervals_above_(0)
+{
+  if (limits_.target_delay.count() > 0)
+    timer_wheel_.schedule(*this, limits_.interval);
+}
+
+bool admission_control::admit_request()
+{
+  bool admit = !limits_.max_requests || requests_ < limits_.max_requests;
+  ++requests_;
+  if (admit && shed_fraction_ > 0)
+  {
+    // Spread the shed requests evenly rather than at random.
+    shed_credit_ += shed_fraction_;
+    if (shed_credit_ >= 1)
+    {
+      shed_credit_ -= 1;
+      admit = false;
+    }
+  }
+  return admit;
+}
+
+void admission_control::stop()
+{
+  timer_wheel_.cancel(*this);
+}
+
+void admission_control::expired()
+{
+  if (timer_wheel_.delay() > limits_.target_delay)
+  {
+    // The first interval above the target may be a burst.
+    if (++intervals_above_ > 1)
+      shed_fraction_ = std::min(max_shed_fraction, shed_fraction_ + shed_step);
+  }
+  else
+  {
+    intervals_above_ = 0;
+    shed_fraction_ = std::max(0.0, shed_fraction_ - shed_step);
+    if (shed_fraction_ == 0)
+      shed_credit_ = 0;
+  }
+  timer_wheel_.schedule(*this, limits_.interval);
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,110 @@
+//
+// admission_control.hpp
+// ~~~~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_ADMISSION_CONTROL_HPP
+#define HTTP_ADMISSION_CONTROL_HPP
+
+#include <chrono>
+#include <cstddef>
+#include "timer_wheel.hpp"
+
+namespace http {
+namespace server {
+
+/// Limits on the load the server takes on. Zero means no limit.
+struct admission_limits
+{
+  admission_limits()
+    : max_connections(0),
+      max_requests(0),
+      target_delay(0),
+      interval(100)
+  {
+  }
+
+  /// The maximum number of open connections.
+  std::size_t max_connections;
+
+  /// The maximum number of requests being served at once, counting from the
+  /// parsed request until its reply is written.
+  std::size_t max_requests;
+
+  /// The event loop delay above which requests are shed.
+  std::chrono::milliseconds target_delay;
+
+  /// How long the delay has to stay above the target before shedding starts,
+  /// and how often the shed fraction is adjusted.
+  std::chrono::milliseconds interval;
+};
+
+/// Decides which connections and requests a worker serves and which it turns
+/// away with a 503 reply. Besides the hard caps, it sheds a share of the
+/// requests while the worker's event loop runs late: like CoDel, it reacts
+/// only once the delay has stayed above the target for a whole interval, so
+/// that bursts pass. Clients do not back off on a 503 the way TCP senders do
+/// on a drop, so instead of CoDel's drop schedule the shed fraction is raised
+/// every interval the delay stays high and lowered again once it is back
+/// below the target. Not thread-safe: each worker has its own.
+class admission_control
+  : private timer_wheel::entry
+{
+public:
+  admission_control(const admission_control&) = delete;
+  admission_control& operator=(const admission_control&) = delete;
+
+  /// Construct with the limits for one worker; the delay is sampled from the
+  /// wheel's ticks.
+  admission_control(const admission_limits& limits, timer_wheel& timers);
+
+  /// Whether a new connection may be served, given the number open.
+  bool admit_connection(std::size_t open) const
+  {
+    return !limits_.max_connections || open < limits_.max_connections;
+  }
+
+  /// Account for a parsed request. Returns whether it is to be served; either
+  /// way request_done() must be called once its reply is written.
+  bool admit_request();
+
+  /// Account for a reply that has been written or dropped.
+  void request_done()
+  {
+    --requests_;
+  }
+
+  /// Stop sampling the delay.
+  void stop();
+
+private:
+  /// Sample the delay and adjust the shed fraction.
+  void expired() override;
+
+  /// The step by which the shed fraction changes per interval.
+  static const double shed_step;
+
+  /// The largest share of requests shed by the delay control.
+  static const double max_shed_fraction;
+
+  admission_limits limits_;
+  timer_wheel& timer_wheel_;
+
+  /// The requests being served.
+  std::size_t requests_;
+
+  /// The share of requests being shed, and the shedding owed so far.
+  double shed_fraction_;
+  double shed_credit_;
+
+  /// The number of consecutive intervals the delay stayed above the target.
+  std::size_t intervals_above_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_ADMISSION_CONTROL_HPP
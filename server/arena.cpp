@@ -0,0 +1,66 @@
+//
+// arena.cpp
+// ~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "arena.hpp"
+#include <algorithm>
+#include <new>
+
+namespace http {
+namespace server {
+
+const std::size_t arena::block_size;
+
+arena::arena()
+  : current_(initial_),
+    end_(initial_ + block_size),
+    blocks_(nullptr),
+    last_(nullptr)
+{
+}
+
+arena::~arena()
+{
+  while (blocks_)
+  {
+    block* next = blocks_->next;
+    ::operator delete(blocks_);
+    blocks_ = next;
+  }
+}
+
+void arena::reset()
+{
+  current_ = initial_;
+  end_ = initial_ + block_size;
+  last_ = nullptr;
+}
+
+void* arena::allocate_block(std::size_t size, std::size_t align)
+{
+  // Blocks too small for this request are skipped until the next reset.
+  block** link = last_ ? &last_->next : &blocks_;
+  while (*link && (*link)->size < size + align)
+    link = &(*link)->next;
+
+  if (!*link)
+  {
+    std::size_t capacity = std::max(block_size, size + align);
+    block* b = static_cast<block*>(::operator new(sizeof(block) + capacity));
+    b->next = nullptr;
+    b->size = capacity;
+    *link = b;
+  }
+
+  last_ = *link;
+  current_ = reinterpret_cast<char*>(last_ + 1);
+  end_ = current_ + last_->size;
+  return allocate(size, align);
+}
+
+} // namespace server
+} // namespace http
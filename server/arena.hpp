@@ -0,0 +1,126 @@
+//
+// arena.hpp
+// ~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_ARENA_HPP
+#define HTTP_ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace http {
+namespace server {
+
+/// A monotonic allocator for storage that lives as long as a batch of
+/// requests. Allocation bumps a pointer through an inline block and then
+/// through heap blocks, which are kept when the arena is reset so that the
+/// next batch allocates nothing. Memory is never freed individually.
+class arena
+{
+public:
+  arena(const arena&) = delete;
+  arena& operator=(const arena&) = delete;
+
+  arena();
+  ~arena();
+
+  /// Allocate size bytes aligned to align, which must be a power of two.
+  void* allocate(std::size_t size, std::size_t align);
+
+  /// Make all memory available again. Everything allocated so far must no
+  /// longer be in use.
+  void reset();
+
+private:
+  /// A heap block; its memory follows the header.
+  struct block
+  {
+    block* next;
+    std::size_t size;
+  };
+
+  /// Allocate from the next heap block that is large enough.
+  void* allocate_block(std::size_t size, std::size_t align);
+
+  /// The size of the inline block and the minimum size of a heap block.
+  static const std::size_t block_size = 4096;
+
+  /// The unused part of the current block.
+  char* current_;
+  char* end_;
+
+  /// The heap blocks, in the order they are used in.
+  block* blocks_;
+
+  /// The heap block in use, or null while in the inline block.
+  block* last_;
+
+  /// The inline block.
+  alignas(16) char initial_[block_size];
+};
+
+inline void* arena::allocate(std::size_t size, std::size_t align)
+{
+  std::uintptr_t p = (reinterpret_cast<std::uintptr_t>(current_) + align - 1) &
+    ~static_cast<std::uintptr_t>(align - 1);
+  std::uintptr_t end = reinterpret_cast<std::uintptr_t>(end_);
+  if (p > end || size > end - p)
+    return allocate_block(size, align);
+  current_ = reinterpret_cast<char*>(p + size);
+  return reinterpret_cast<void*>(p);
+}
+
+/// A standard allocator drawing from an arena, for containers and
+/// std::allocate_shared. Deallocation does nothing.
+template <typename T>
+class arena_allocator
+{
+public:
+  typedef T value_type;
+
+  explicit arena_allocator(arena& a)
+    : arena_(&a)
+  {
+  }
+
+  template <typename U>
+  arena_allocator(const arena_allocator<U>& other)
+    : arena_(other.arena_)
+  {
+  }
+
+  T* allocate(std::size_t n)
+  {
+    return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T*, std::size_t)
+  {
+  }
+
+  template <typename U>
+  bool operator==(const arena_allocator<U>& other) const
+  {
+    return arena_ == other.arena_;
+  }
+
+  template <typename U>
+  bool operator!=(const arena_allocator<U>& other) const
+  {
+    return arena_ != other.arena_;
+  }
+
+private:
+  template <typename U> friend class arena_allocator;
+
+  arena* arena_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_ARENA_HPP
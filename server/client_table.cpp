@@ -0,0 +1,94 @@
+//
+// client_table.cpp
+// ~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "client_table.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+namespace http {
+namespace server {
+
+const int client_table::empty_id = std::numeric_limits<int>::min();
+
+client_table::client_table(const std::map<int, std::string>& clients,
+    const std::uint8_t nonce[8])
+  : ciphers_(nullptr),
+    dense_(true),
+    base_(0),
+    mask_(0),
+    shift_(64),
+    size_(clients.size())
+{
+  static_assert(std::is_trivially_destructible<Salsa20>::value,
+      "cipher states are never destroyed");
+  const slot unused = {empty_id, 0};
+
+  // Operator new only promises the alignment of the fundamental types, so
+  // the key states are placed in storage aligned by hand.
+  cipher_storage_.reset(
+      new char[clients.size() * sizeof(cipher_slot) + alignof(cipher_slot)]);
+  std::uintptr_t address =
+    reinterpret_cast<std::uintptr_t>(cipher_storage_.get());
+  ciphers_ = reinterpret_cast<cipher_slot*>(
+      (address + alignof(cipher_slot) - 1) & ~(alignof(cipher_slot) - 1));
+
+  // Use a flat array when at least half of it would be in use.
+  if (!clients.empty())
+  {
+    std::int64_t span = static_cast<std::int64_t>(clients.rbegin()->first) -
+      clients.begin()->first + 1;
+    dense_ = span <= 2 * static_cast<std::int64_t>(clients.size());
+    if (dense_)
+    {
+      base_ = clients.begin()->first;
+      slots_.assign(static_cast<std::size_t>(span), unused);
+    }
+    else
+    {
+      // Keep the load factor at or below one half.
+      std::size_t capacity = 2;
+      shift_ = 63;
+      while (capacity < 2 * clients.size())
+      {
+        capacity *= 2;
+        --shift_;
+      }
+      mask_ = capacity - 1;
+      slots_.assign(capacity, unused);
+    }
+  }
+
+  std::uint32_t next = 0;
+  for (const auto& client: clients)
+  {
+    // Keys are zero padded or truncated to 16 bytes.
+    std::uint8_t key[16] = {0};
+    std::copy(client.second.begin(),
+        client.second.begin() + std::min(client.second.size(), sizeof(key)),
+        key);
+    new (&ciphers_[next].cipher) Salsa20(key, sizeof(key), nonce);
+
+    std::size_t i = dense_ ? static_cast<std::size_t>(client.first) - base_
+      : hash(client.first);
+    while (slots_[i].id != empty_id)
+      i = (i + 1) & mask_;
+    slots_[i].id = client.first;
+    slots_[i].cipher = next++;
+  }
+}
+
+std::size_t client_table::size() const
+{
+  return size_;
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,123 @@
+//
+// client_table.hpp
+// ~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_CLIENT_TABLE_HPP
+#define HTTP_CLIENT_TABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../Salsa20/Salsa20.h"
+
+namespace http {
+namespace server {
+
+/// The known clients with their keys already expanded into Salsa20 state.
+/// Ids that cover a compact range are stored in a flat array indexed by id,
+/// sparse ids in an open-addressing hash table with linear probing. The
+/// probed slots hold just the id and where the client's key state is, eight
+/// to a cache line; the key states are packed in an array of their own, each
+/// on a cache line, so a lookup touches one line of slots and one of key
+/// state in the common case. The table is immutable after construction and
+/// safe for concurrent readers.
+class client_table
+{
+public:
+  client_table(const client_table&) = delete;
+  client_table& operator=(const client_table&) = delete;
+
+  /// Build the table from client ids and keys, using the given nonce.
+  client_table(const std::map<int, std::string>& clients,
+      const std::uint8_t nonce[8]);
+
+  /// The cipher of the client with the given id, or null if it is unknown.
+  const Salsa20* find(int id) const;
+
+  /// The number of known clients.
+  std::size_t size() const;
+
+private:
+  /// A client id and the index of its key state in ciphers_.
+  struct slot
+  {
+    int id;
+    std::uint32_t cipher;
+  };
+
+  /// The key state of a client, starting a cache line. The 64 bytes of
+  /// state the keystream is made from lie on that line alone.
+  struct alignas(64) cipher_slot
+  {
+    Salsa20 cipher;
+  };
+
+  /// The slot a client id hashes to in sparse mode.
+  std::size_t hash(int id) const;
+
+  /// The id marking an unused slot.
+  static const int empty_id;
+
+  /// The slots, indexed by id - base_ when dense, by hash otherwise.
+  std::vector<slot> slots_;
+
+  /// The key states of the clients, one per client, in storage aligned to
+  /// a cache line.
+  std::unique_ptr<char[]> cipher_storage_;
+  cipher_slot* ciphers_;
+
+  /// Whether slots_ is a flat array rather than a hash table.
+  bool dense_;
+
+  /// The smallest client id in dense mode.
+  int base_;
+
+  /// The capacity mask in sparse mode.
+  std::size_t mask_;
+
+  /// The shift taking a hash product to a slot in sparse mode.
+  unsigned shift_;
+
+  /// The number of known clients.
+  std::size_t size_;
+};
+
+inline const Salsa20* client_table::find(int id) const
+{
+  if (dense_)
+  {
+    std::size_t index = static_cast<std::size_t>(id) - base_;
+    if (index < slots_.size() && slots_[index].id == id)
+      return &ciphers_[slots_[index].cipher].cipher;
+    return nullptr;
+  }
+
+  for (std::size_t i = hash(id);; i = (i + 1) & mask_)
+  {
+    const slot& s = slots_[i];
+    if (s.id == id)
+      return &ciphers_[s.cipher].cipher;
+    if (s.id == empty_id)
+      return nullptr;
+  }
+}
+
+inline std::size_t client_table::hash(int id) const
+{
+  // Fibonacci hashing: the high bits of the product spread the ids evenly.
+  return static_cast<std::size_t>(
+      (static_cast<std::uint64_t>(static_cast<std::uint32_t>(id)) *
+       11400714819323198485ull) >> shift_);
+}
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_CLIENT_TABLE_HPP
@@ -9,32 +9,182 @@
 //
 
 #include "connection.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <functional>
 #include <utility>
 #include <vector>
+#include <boost/algorithm/string/find.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include "connection_manager.hpp"
 #include "request_handler.hpp"
 
 namespace http {
 namespace server {
 
-connection::connection(boost::asio::ip::tcp::socket socket,
-    connection_manager& manager, request_handler& handler)
-  : socket_(std::move(socket)),
+namespace {
+
+/// Determine whether the client asked for a persistent connection. HTTP/1.1
+/// connections persist unless closed explicitly, HTTP/1.0 ones only when
+/// "Connection: keep-alive" is present.
+bool keep_alive(const request& req)
+{
+  for (const header& h: req.headers)
+  {
+    if (!boost::algorithm::iequals(h.name, "Connection"))
+      continue;
+    if (boost::algorithm::ifind_first(h.value, "close"))
+      return false;
+    if (boost::algorithm::ifind_first(h.value, "keep-alive"))
+      return true;
+  }
+  return req.http_version_major > 1 ||
+    (req.http_version_major == 1 && req.http_version_minor >= 1);
+}
+
+/// The time a client has to send a whole request.
+const std::chrono::seconds header_timeout(10);
+
+/// The time an idle keep-alive connection is kept open.
+const std::chrono::seconds idle_timeout(15);
+
+/// The time a write may go without progress.
+const std::chrono::seconds write_timeout(30);
+
+} // namespace
+
+connection::connection(boost::asio::io_context& io_context,
+    connection_manager& manager, request_handler& handler,
+    timer_wheel& timers, admission_control& admission, io_ring& ring,
+    offload_pool& offload, access_log::ring* log)
+  : io_context_(io_context),
+    socket_(io_context),
     connection_manager_(manager),
-    request_handler_(handler)
+    request_handler_(handler),
+    timer_wheel_(timers),
+    admission_control_(admission),
+    io_ring_(ring),
+    offload_pool_(offload),
+    access_log_(log),
+    deadline_(no_deadline),
+    request_(),
+    buffer_begin_(0),
+    buffer_end_(0),
+    reply_begin_(0),
+    reply_end_(0),
+    keep_alive_(true),
+    body_chunks_(nullptr),
+    body_registered_(-1),
+    body_index_(0),
+    body_ready_(0),
+    body_reading_(false),
+    body_waiting_(false),
+    stopped_(false),
+    send_data_(nullptr),
+    send_size_(0),
+    body_read_(this, &connection::handle_body_read),
+    body_send_(this, &connection::handle_body_send),
+    body_work_(this)
+{
+}
+
+void connection::reset(boost::asio::ip::tcp::socket socket)
 {
+  socket_ = std::move(socket);
+}
+
+void connection::recycle()
+{
+  boost::system::error_code ignored_ec;
+  socket_.close(ignored_ec);
+  timer_wheel_.cancel(*this);
+  deadline_ = no_deadline;
+  request_.clear();
+  request_parser_.reset();
+  buffer_begin_ = 0;
+  buffer_end_ = 0;
+  for (std::size_t i = reply_begin_; i < reply_end_; ++i)
+  {
+    replies_[i].clear();
+    admission_control_.request_done();
+  }
+  reply_begin_ = 0;
+  reply_end_ = 0;
+  body_.reset();
+  release_body_chunks();
+  arena_.reset();
+  keep_alive_ = true;
+  body_index_ = 0;
+  body_ready_ = 0;
+  body_reading_ = false;
+  body_waiting_ = false;
+  stopped_ = false;
 }
 
 void connection::start()
 {
+  // The headers and the first body chunk go out in separate writes; without
+  // this the body waits for the client's delayed ACK of the headers.
+  boost::system::error_code ignored_ec;
+  socket_.set_option(boost::asio::ip::tcp::no_delay(true), ignored_ec);
+  set_deadline(header_deadline);
   do_read();
 }
 
 void connection::stop()
 {
+  timer_wheel_.cancel(*this);
+  deadline_ = no_deadline;
+  stopped_ = true;
+  if (body_read_.self || body_send_.self)
+  {
+    // A queued send reaches the kernel only when the ring is next submitted,
+    // so the descriptor must not be reused by another client until then:
+    // the socket stays open until the operations are back and the last of
+    // them recycles the connection.
+    boost::system::error_code ignored_ec;
+    socket_.cancel(ignored_ec);
+    if (body_read_.self)
+      io_ring_.cancel(body_read_);
+    if (body_send_.self)
+      io_ring_.cancel(body_send_);
+    return;
+  }
   socket_.close();
 }
 
+void connection::set_deadline(deadline_type type)
+{
+  if (type == deadline_ && type == header_deadline)
+    return;
+  deadline_ = type;
+  switch (type)
+  {
+  case idle_deadline:
+    timer_wheel_.schedule(*this, idle_timeout);
+    break;
+  case header_deadline:
+    timer_wheel_.schedule(*this, header_timeout);
+    break;
+  case write_deadline:
+    timer_wheel_.schedule(*this, write_timeout);
+    break;
+  default:
+    timer_wheel_.cancel(*this);
+    break;
+  }
+}
+
+void connection::expired()
+{
+  // Reset rather than close gracefully, so that the kernel does not keep
+  // trying to deliver unsent data to a client that stopped reading.
+  boost::system::error_code ignored_ec;
+  socket_.set_option(boost::asio::socket_base::linger(true, 0), ignored_ec);
+  deadline_ = no_deadline;
+  connection_manager_.stop(shared_from_this());
+}
+
 void connection::do_read()
 {
   auto self(shared_from_this());
@@ -43,23 +193,135 @@ void connection::do_read()
       {
         if (!ec)
         {
-          request_parser::result_type result;
-          std::tie(result, std::ignore) = request_parser_.parse(
-              request_, buffer_.data(), buffer_.data() + bytes_transferred);
+          metrics::count_bytes_in(bytes_transferred);
+          handle_input(buffer_.data(), buffer_.data() + bytes_transferred);
+        }
+        else if (ec != boost::asio::error::operation_aborted)
+        {
+          connection_manager_.stop(shared_from_this());
+        }
+      });
+}
+
+void connection::handle_input(char* begin, char* end)
+{
+  bool partial = false;
+  while (begin != end && keep_alive_ && reply_end_ < max_pipelined_replies)
+  {
+    request_parser::result_type result;
+    metrics::time_point start = metrics::now();
+    std::tie(result, begin) = request_parser_.parse(request_, begin, end);
+    metrics::time_point received = metrics::record(metrics::parse, start);
+
+    if (result == request_parser::indeterminate)
+    {
+      // The whole input has been consumed by a partial request.
+      partial = true;
+      break;
+    }
+
+    reply& rep = replies_[reply_end_++];
+    bool admitted = admission_control_.admit_request();
+    if (result == request_parser::bad)
+    {
+      keep_alive_ = false;
+      reply::stock_reply(reply::bad_request, rep);
+    }
+    else if (!admitted)
+    {
+      keep_alive_ = false;
+      reply::overloaded_reply(rep);
+    }
+    else
+    {
+      keep_alive_ = keep_alive(request_);
+      request_handler_.handle_request(request_, rep, arena_);
+      if (request_.method == "HEAD")
+        rep.head_only();
+    }
+
+    rep.set_keep_alive(keep_alive_);
+    metrics::count_status(rep.status);
+    if (access_log_)
+    {
+      access_log::record& r = log_records_[reply_end_ - 1];
+      r.latency = received;
+      r.client = rep.client_id;
+      r.path_hash = rep.path_hash;
+      r.status = static_cast<std::uint16_t>(rep.status);
+      r.reserved = 0;
+    }
+    request_parser_.reset();
+    request_.clear();
+  }
+
+  // Whatever is left belongs to requests that are handled after the write.
+  buffer_begin_ = begin - buffer_.data();
+  buffer_end_ = end - buffer_.data();
+
+  if (reply_begin_ == reply_end_)
+  {
+    set_deadline(partial ? header_deadline : idle_deadline);
+    do_read();
+  }
+  else
+  {
+    do_write();
+  }
+}
 
-          if (result == request_parser::good)
+void connection::do_write()
+{
+  // Replies are batched until one with a streamed body, which has to follow
+  // its headers on the wire before any later reply.
+  std::size_t count = reply_begin_;
+  write_buffers_.clear();
+  while (count < reply_end_)
+  {
+    reply& rep = replies_[count++];
+    std::size_t first = write_buffers_.size();
+    rep.to_buffers(write_buffers_);
+    if (access_log_)
+    {
+      std::uint64_t bytes = rep.body ? rep.body->remaining() : 0;
+      for (std::size_t i = first; i < write_buffers_.size(); ++i)
+        bytes += write_buffers_[i].size();
+      log_records_[count - 1].bytes = bytes;
+    }
+    if (rep.body)
+      break;
+  }
+
+  set_deadline(write_deadline);
+  write_start_ = metrics::now();
+  auto self(shared_from_this());
+  boost::asio::async_write(socket_, write_buffers_,
+      [this, self, count](boost::system::error_code ec, std::size_t length)
+      {
+        if (!ec)
+        {
+          metrics::record(metrics::write, write_start_);
+          metrics::count_bytes_out(length);
+          for (; reply_begin_ < count; ++reply_begin_)
           {
-            request_handler_.handle_request(request_, reply_);
-            do_write();
+            // A streamed body is logged once it is sent as well.
+            if (access_log_)
+            {
+              if (replies_[reply_begin_].body)
+                body_record_ = log_records_[reply_begin_];
+              else
+                log_reply(log_records_[reply_begin_]);
+            }
+            replies_[reply_begin_].clear();
+            admission_control_.request_done();
           }
-          else if (result == request_parser::bad)
+          if (body_)
           {
-            reply_ = reply::stock_reply(reply::bad_request);
-            do_write();
+            do_write_body();
           }
           else
           {
-            do_read();
+            handle_write_complete();
           }
         }
         else if (ec != boost::asio::error::operation_aborted)
@@ -67,28 +329,284 @@ void connection::do_read()
           connection_manager_.stop(shared_from_this());
         }
       });
+
+  // Prepare the first chunk of the body while the headers are being sent.
+  body_ = replies_[count - 1].body;
+  if (body_)
+  {
+    if (io_ring_.enabled() && body_->file_descriptor() >= 0)
+      body_registered_ = io_ring_.acquire_buffer();
+    if (body_registered_ >= 0)
+    {
+      body_chunks_ = io_ring_.buffer_data(body_registered_);
+    }
+    else
+    {
+      if (!body_buffer_)
+        body_buffer_.reset(new char[2 * body_chunk_size]);
+      body_chunks_ = body_buffer_.get();
+    }
+    fill_body_chunk();
+  }
 }
 
-void connection::do_write()
+void connection::do_write_body()
+{
+  // The socket of a stopped connection may still be open for io_ring_.
+  if (stopped_)
+    return;
+
+  if (body_reading_)
+  {
+    body_waiting_ = true;
+    return;
+  }
+
+  if (body_ready_ == 0)
+  {
+    // A body that ends early cannot be reported to the client any more, the
+    // connection has to be dropped instead.
+    bool complete = body_->remaining() == 0;
+    body_.reset();
+    release_body_chunks();
+    if (complete)
+    {
+      if (access_log_)
+        log_reply(body_record_);
+      handle_write_complete();
+    }
+    else
+    {
+      connection_manager_.stop(shared_from_this());
+    }
+    return;
+  }
+
+  set_deadline(write_deadline);
+  write_start_ = metrics::now();
+  send_data_ = body_chunks_ + body_index_ * body_chunk_size;
+  send_size_ = body_ready_;
+  send_body();
+
+  // Prepare the next chunk while the previous one is being sent.
+  fill_body_chunk();
+}
+
+void connection::fill_body_chunk()
+{
+  body_index_ ^= 1;
+  char* data = body_chunks_ + body_index_ * body_chunk_size;
+  std::size_t size = static_cast<std::size_t>(
+      std::min<std::uint64_t>(body_chunk_size, body_->remaining()));
+  if (size == 0)
+  {
+    body_ready_ = 0;
+    return;
+  }
+
+  // The chunk is prepared while the worker goes on; a cold file or a long
+  // body does not hold up the other connections. The file is read by the
+  // kernel through io_ring_, or else by offload_pool_.
+  body_reading_ = true;
+  int fd = body_->file_descriptor();
+  if (io_ring_.enabled() && fd >= 0)
+  {
+    body_read_.self = shared_from_this();
+    if (io_ring_.read(body_read_, fd, data, size, body_->offset(),
+        body_registered_))
+      return;
+    body_read_.self.reset();
+  }
+  if (offload_body(data, body_chunk_size, true))
+    return;
+  body_reading_ = false;
+  body_ready_ = body_->read(data, body_chunk_size);
+}
+
+bool connection::offload_body(char* data, std::size_t size, bool read_file)
+{
+  body_work_.data = data;
+  body_work_.size = size;
+  body_work_.read_file = read_file;
+  body_work_.self = shared_from_this();
+  io_context_.get_executor().on_work_started();
+  if (offload_pool_.post(body_work_))
+    return true;
+  io_context_.get_executor().on_work_finished();
+  body_work_.self.reset();
+  return false;
+}
+
+void connection::offload_operation::run()
+{
+  // The connection leaves the body alone until the result is back.
+  std::size_t result = size;
+  if (read_file)
+    result = owner->body_->read(data, size);
+  else
+    owner->body_->consume(data, size);
+
+  // The last reference to the connection must not be dropped here, off the
+  // worker's thread.
+  boost::asio::io_context& io_context = owner->io_context_;
+  boost::asio::post(io_context,
+      std::bind(&connection::handle_body_ready, std::move(self), result));
+  io_context.get_executor().on_work_finished();
+}
+
+void connection::handle_body_read(int result)
+{
+  if (stopped_)
+  {
+    body_reading_ = false;
+    return;
+  }
+
+  // A failed read ends the body early.
+  std::size_t size = result > 0 ? static_cast<std::size_t>(result) : 0;
+  if (size > 0)
+  {
+    char* data = body_chunks_ + body_index_ * body_chunk_size;
+    if (offload_body(data, size, false))
+      return;
+    body_->consume(data, size);
+  }
+  handle_body_ready(size);
+}
+
+void connection::handle_body_ready(std::size_t size)
+{
+  body_reading_ = false;
+  if (stopped_)
+    return;
+
+  body_ready_ = size;
+  if (body_waiting_)
+  {
+    body_waiting_ = false;
+    do_write_body();
+  }
+}
+
+void connection::handle_body_send(int result)
+{
+  if (stopped_)
+    return;
+
+  if (result == -EAGAIN)
+  {
+    // The ring does not wait for a non-blocking socket on every kernel;
+    // the reactor does.
+    async_send_body();
+    return;
+  }
+
+  if (result < 0)
+  {
+    connection_manager_.stop(shared_from_this());
+    return;
+  }
+
+  metrics::count_bytes_out(static_cast<std::size_t>(result));
+  send_data_ += result;
+  send_size_ -= static_cast<std::size_t>(result);
+  if (send_size_ > 0)
+  {
+    set_deadline(write_deadline);
+    send_body();
+    return;
+  }
+  metrics::record(metrics::write, write_start_);
+  do_write_body();
+}
+
+void connection::send_body()
+{
+  if (io_ring_.enabled())
+  {
+    body_send_.self = shared_from_this();
+    if (io_ring_.send(body_send_, socket_.native_handle(), send_data_,
+        send_size_))
+      return;
+    body_send_.self.reset();
+  }
+  async_send_body();
+}
+
+void connection::async_send_body()
 {
   auto self(shared_from_this());
-  boost::asio::async_write(socket_, reply_.to_buffers(),
-      [this, self](boost::system::error_code ec, std::size_t)
+  boost::asio::async_write(socket_,
+      boost::asio::buffer(send_data_, send_size_),
+      [this, self](boost::system::error_code ec, std::size_t length)
       {
         if (!ec)
         {
-          // Initiate graceful connection closure.
-          boost::system::error_code ignored_ec;
-          socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both,
-            ignored_ec);
+          metrics::record(metrics::write, write_start_);
+          metrics::count_bytes_out(length);
+          do_write_body();
         }
-
-        if (ec != boost::asio::error::operation_aborted)
+        else if (ec != boost::asio::error::operation_aborted)
         {
           connection_manager_.stop(shared_from_this());
         }
       });
 }
 
+void connection::release_body_chunks()
+{
+  if (body_registered_ >= 0)
+    io_ring_.release_buffer(body_registered_);
+  body_registered_ = -1;
+  body_chunks_ = nullptr;
+}
+
+void connection::log_reply(access_log::record& r)
+{
+  std::uint64_t latency = metrics::nanoseconds(r.latency, metrics::now());
+  std::uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  r.time = now - latency;
+  r.latency = latency;
+  access_log_->push(r);
+}
+
+void connection::handle_write_complete()
+{
+  if (reply_begin_ != reply_end_)
+  {
+    do_write();
+    return;
+  }
+
+  // Nothing refers to the storage of the sent replies any more.
+  reply_begin_ = 0;
+  reply_end_ = 0;
+  arena_.reset();
+
+  if (keep_alive_)
+  {
+    if (buffer_begin_ != buffer_end_)
+    {
+      handle_input(buffer_.data() + buffer_begin_,
+          buffer_.data() + buffer_end_);
+    }
+    else
+    {
+      // A request whose start came with the last batch keeps its deadline.
+      set_deadline(request_.method.empty() ? idle_deadline : header_deadline);
+      do_read();
+    }
+  }
+  else
+  {
+    // Initiate graceful connection closure.
+    boost::system::error_code ignored_ec;
+    socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both,
+      ignored_ec);
+    connection_manager_.stop(shared_from_this());
+  }
+}
+
 } // namespace server
 } // namespace http
\ No newline at end of file
@@ -12,12 +12,21 @@
 #define HTTP_CONNECTION_HPP
 
 #include <array>
+#include <cstddef>
 #include <memory>
+#include <vector>
 #include <boost/asio.hpp>
+#include "access_log.hpp"
+#include "admission_control.hpp"
+#include "arena.hpp"
+#include "io_ring.hpp"
+#include "metrics.hpp"
+#include "offload_pool.hpp"
 #include "reply.hpp"
 #include "request.hpp"
 #include "request_handler.hpp"
 #include "request_parser.hpp"
+#include "timer_wheel.hpp"
 
 namespace http {
 namespace server {
@@ -26,29 +35,156 @@ class connection_manager;
 
 /// Represents a single connection from a client.
 class connection
-  : public std::enable_shared_from_this<connection>
+  : public std::enable_shared_from_this<connection>,
+    private timer_wheel::entry
 {
 public:
   connection(const connection&) = delete;
   connection& operator=(const connection&) = delete;
 
-  /// Construct a connection with the given socket.
-  explicit connection(boost::asio::ip::tcp::socket socket,
-      connection_manager& manager, request_handler& handler);
+  /// Construct a connection without a socket yet.
+  connection(boost::asio::io_context& io_context,
+      connection_manager& manager, request_handler& handler,
+      timer_wheel& timers, admission_control& admission, io_ring& ring,
+      offload_pool& offload, access_log::ring* log);
+
+  /// Take over a newly accepted socket.
+  void reset(boost::asio::ip::tcp::socket socket);
+
+  /// Drop the state of the last client, keeping the allocated storage for
+  /// the next one. No operation may be outstanding.
+  void recycle();
 
   /// Start the first asynchronous operation for the connection.
   void start();
 
-  /// Stop all asynchronous operations associated with the connection.
+  /// Stop all asynchronous operations associated with the connection. The
+  /// socket is closed at once unless io_ring_ still has operations of the
+  /// connection, in which case recycle() closes it after them.
   void stop();
 
 private:
+  /// What the deadline of the connection is guarding.
+  enum deadline_type
+  {
+    no_deadline,
+    /// Waiting for the next request on an idle keep-alive connection.
+    idle_deadline,
+    /// Receiving a request; not extended by the arrival of more bytes.
+    header_deadline,
+    /// Writing replies; extended whenever a write completes.
+    write_deadline
+  };
+
+  /// Arm the deadline for the given phase.
+  void set_deadline(deadline_type type);
+
+  /// Close the connection once its deadline has passed.
+  void expired() override;
+
   /// Perform an asynchronous read operation.
   void do_read();
 
-  /// Perform an asynchronous write operation.
+  /// Parse and handle the received bytes in [begin, end), then either write
+  /// the resulting replies or read more data.
+  void handle_input(char* begin, char* end);
+
+  /// Perform an asynchronous write of the queued replies, up to and including
+  /// the first one with a streamed body.
   void do_write();
 
+  /// Perform an asynchronous write of the next chunk of the streamed body.
+  void do_write_body();
+
+  /// Continue after the queued replies have been written.
+  void handle_write_complete();
+
+  /// Read and encrypt the next chunk of the streamed body into the spare half
+  /// of body_chunks_. Unless done on the spot, the chunk is ready once
+  /// handle_body_ready() has run.
+  void fill_body_chunk();
+
+  /// Have offload_pool_ read the next size bytes of the body into data, or
+  /// only encrypt them if read_file is false. Returns false if the pool
+  /// cannot take the work, in which case it is left to the caller.
+  bool offload_body(char* data, std::size_t size, bool read_file);
+
+  /// Take the next chunk of the body read through io_ring_.
+  void handle_body_read(int result);
+
+  /// Take the next chunk of the body once it is ready to be sent.
+  void handle_body_ready(std::size_t size);
+
+  /// Continue the send of a chunk of the body through io_ring_.
+  void handle_body_send(int result);
+
+  /// Send the rest of the chunk at send_data_, through io_ring_ if it has
+  /// room, otherwise through the reactor.
+  void send_body();
+
+  /// Send the rest of the chunk at send_data_ through the reactor.
+  void async_send_body();
+
+  /// Give back the storage of the body chunks.
+  void release_body_chunks();
+
+  /// Complete an access log record whose latency holds the time the request
+  /// was received, and queue it.
+  void log_reply(access_log::record& r);
+
+  /// An operation of the connection in io_ring_, which keeps the connection
+  /// alive while in flight.
+  struct ring_operation : io_ring::operation
+  {
+    ring_operation(connection* c, void (connection::*h)(int))
+      : owner(c),
+        handler(h)
+    {
+    }
+
+    void complete(int result) override
+    {
+      std::shared_ptr<connection> keep(std::move(self));
+      (owner->*handler)(result);
+    }
+
+    connection* owner;
+    void (connection::*handler)(int);
+    std::shared_ptr<connection> self;
+  };
+
+  /// Work of the connection in offload_pool_, which keeps the connection and
+  /// the worker's io_context running until the result is back on the
+  /// worker's thread.
+  struct offload_operation : offload_pool::task
+  {
+    explicit offload_operation(connection* c)
+      : owner(c),
+        data(nullptr),
+        size(0),
+        read_file(false)
+    {
+    }
+
+    void run() override;
+
+    connection* owner;
+    std::shared_ptr<connection> self;
+    char* data;
+    std::size_t size;
+    bool read_file;
+  };
+
+  /// The maximum number of pipelined replies batched into a single write.
+  static const std::size_t max_pipelined_replies = 16;
+
+  /// The size of a chunk of a streamed body. Must be a multiple of the
+  /// Salsa20 block size.
+  static const std::size_t body_chunk_size = 16384;
+
+  /// The io_context of the worker the connection belongs to.
+  boost::asio::io_context& io_context_;
+
   /// Socket for the connection.
   boost::asio::ip::tcp::socket socket_;
 
@@ -58,6 +194,24 @@ private:
   /// The handler used to process the incoming request.
   request_handler& request_handler_;
 
+  /// The deadlines of the worker's connections.
+  timer_wheel& timer_wheel_;
+
+  /// Decides which requests are served.
+  admission_control& admission_control_;
+
+  /// The worker's io_uring, which streams the bodies of files if enabled.
+  io_ring& io_ring_;
+
+  /// The threads that read and encrypt the bodies of files.
+  offload_pool& offload_pool_;
+
+  /// Where the access log records of the worker go, or null.
+  access_log::ring* access_log_;
+
+  /// The phase the current deadline guards.
+  deadline_type deadline_;
+
   /// Buffer for incoming data.
   std::array<char, 8192> buffer_;
 
@@ -67,8 +221,70 @@ private:
   /// The parser for the incoming request.
   request_parser request_parser_;
 
-  /// The reply to be sent back to the client.
-  reply reply_;
+  /// Offsets of the received bytes in buffer_ that are not parsed yet. They
+  /// belong to pipelined requests that did not fit into the last batch.
+  std::size_t buffer_begin_;
+  std::size_t buffer_end_;
+
+  /// The replies to be sent back to the client, in request order, are
+  /// [reply_begin_, reply_end_) of replies_. The slots are reused, so their
+  /// storage outlives the requests.
+  std::array<reply, max_pipelined_replies> replies_;
+  std::size_t reply_begin_;
+  std::size_t reply_end_;
+
+  /// The access log records of the replies in replies_, filled in as the
+  /// replies are made and sent, and that of the reply whose body is being
+  /// streamed.
+  std::array<access_log::record, max_pipelined_replies> log_records_;
+  access_log::record body_record_;
+
+  /// Storage for the replies in replies_, reset once they are all sent.
+  arena arena_;
+
+  /// The buffers of the write in progress, and when it was started.
+  std::vector<boost::asio::const_buffer> write_buffers_;
+  metrics::time_point write_start_;
+
+  /// Whether the connection stays open once the queued replies are written.
+  bool keep_alive_;
+
+  /// The body being streamed, if any.
+  std::shared_ptr<body_source> body_;
+
+  /// Two chunks of the streamed body: one is on the wire while the other is
+  /// being prepared. They are a buffer registered with io_ring_ while a body
+  /// is streamed through it, otherwise body_buffer_.
+  char* body_chunks_;
+
+  /// The index of the registered buffer in use, or -1.
+  int body_registered_;
+
+  /// The storage of the chunks when no registered buffer is used. Allocated
+  /// on first use.
+  std::unique_ptr<char[]> body_buffer_;
+
+  /// The half of body_chunks_ holding the next chunk to write.
+  std::size_t body_index_;
+
+  /// The number of bytes ready in that half.
+  std::size_t body_ready_;
+
+  /// Whether a chunk is being prepared away from the worker's thread, and
+  /// whether the next write waits for it.
+  bool body_reading_;
+  bool body_waiting_;
+
+  /// Whether stop() has run, while the socket may still be open.
+  bool stopped_;
+
+  /// The part of a chunk not sent yet through io_ring_.
+  const char* send_data_;
+  std::size_t send_size_;
+
+  ring_operation body_read_;
+  ring_operation body_send_;
+  offload_operation body_work_;
 };
 
 typedef std::shared_ptr<connection> connection_ptr;
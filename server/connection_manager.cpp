@@ -9,6 +9,7 @@
 //
 
 #include "connection_manager.hpp"
+#include "metrics.hpp"
 
 namespace http {
 namespace server {
@@ -20,19 +21,24 @@ connection_manager::connection_manager()
 void connection_manager::start(connection_ptr c)
 {
   connections_.insert(c);
+  metrics::connection_opened();
   c->start();
 }
 
 void connection_manager::stop(connection_ptr c)
 {
-  connections_.erase(c);
+  if (connections_.erase(c))
+    metrics::connection_closed();
   c->stop();
 }
 
 void connection_manager::stop_all()
 {
   for (auto c: connections_)
+  {
+    metrics::connection_closed();
     c->stop();
+  }
   connections_.clear();
 }
 
@@ -37,6 +37,12 @@ public:
   /// Stop all connections.
   void stop_all();
 
+  /// The number of open connections.
+  std::size_t size() const
+  {
+    return connections_.size();
+  }
+
 private:
   /// The managed connections.
   std::set<connection_ptr> connections_;
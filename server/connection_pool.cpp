@@ -0,0 +1,67 @@
+//
+// connection_pool.cpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "connection_pool.hpp"
+#include <utility>
+
+namespace http {
+namespace server {
+
+connection_pool::connection_pool(boost::asio::io_context& io_context,
+    connection_manager& manager, request_handler& handler,
+    timer_wheel& timers, admission_control& admission, io_ring& ring,
+    offload_pool& offload, access_log::ring* log, std::size_t preallocate)
+  : io_context_(io_context),
+    connection_manager_(manager),
+    request_handler_(handler),
+    timer_wheel_(timers),
+    admission_control_(admission),
+    io_ring_(ring),
+    offload_pool_(offload),
+    access_log_(log)
+{
+  idle_.reserve(max_idle_connections);
+  for (std::size_t i = 0; i < preallocate && i < max_idle_connections; ++i)
+    idle_.emplace_back(
+        new connection(io_context_, connection_manager_, request_handler_,
+            timer_wheel_, admission_control_, io_ring_, offload_pool_,
+            access_log_));
+}
+
+connection_ptr connection_pool::acquire(boost::asio::ip::tcp::socket socket)
+{
+  std::unique_ptr<connection> c;
+  if (idle_.empty())
+  {
+    c.reset(new connection(io_context_, connection_manager_, request_handler_,
+            timer_wheel_, admission_control_, io_ring_, offload_pool_,
+            access_log_));
+  }
+  else
+  {
+    c = std::move(idle_.back());
+    idle_.pop_back();
+  }
+  c->reset(std::move(socket));
+  return connection_ptr(c.release(),
+      [this](connection* c)
+      {
+        release(c);
+      });
+}
+
+void connection_pool::release(connection* c)
+{
+  std::unique_ptr<connection> owner(c);
+  owner->recycle();
+  if (idle_.size() < max_idle_connections)
+    idle_.push_back(std::move(owner));
+}
+
+} // namespace server
+} // namespace http
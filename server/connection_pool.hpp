@@ -0,0 +1,71 @@
+//
+// connection_pool.hpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_CONNECTION_POOL_HPP
+#define HTTP_CONNECTION_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+#include "connection.hpp"
+
+namespace http {
+namespace server {
+
+class admission_control;
+class connection_manager;
+class io_ring;
+class offload_pool;
+class request_handler;
+class timer_wheel;
+
+/// The connection objects of a worker. A connection goes back to the pool
+/// when its last reference is dropped and is handed out again for a later
+/// socket, keeping its buffers, so that accepting a client allocates no new
+/// connection at steady state. Not thread-safe: the pool and its connections
+/// belong to the worker's thread, and the pool must outlive them.
+class connection_pool
+{
+public:
+  connection_pool(const connection_pool&) = delete;
+  connection_pool& operator=(const connection_pool&) = delete;
+
+  /// Construct a pool with the given number of connections ready.
+  connection_pool(boost::asio::io_context& io_context,
+      connection_manager& manager, request_handler& handler,
+      timer_wheel& timers, admission_control& admission, io_ring& ring,
+      offload_pool& offload, access_log::ring* log, std::size_t preallocate);
+
+  /// Get a connection for a newly accepted socket.
+  connection_ptr acquire(boost::asio::ip::tcp::socket socket);
+
+private:
+  /// Take back a connection that is no longer referenced.
+  void release(connection* c);
+
+  /// The maximum number of idle connections kept.
+  static const std::size_t max_idle_connections = 1024;
+
+  boost::asio::io_context& io_context_;
+  connection_manager& connection_manager_;
+  request_handler& request_handler_;
+  timer_wheel& timer_wheel_;
+  admission_control& admission_control_;
+  io_ring& io_ring_;
+  offload_pool& offload_pool_;
+  access_log::ring* access_log_;
+
+  /// The idle connections.
+  std::vector<std::unique_ptr<connection>> idle_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_CONNECTION_POOL_HPP
@@ -0,0 +1,123 @@
+//
+// decoded_uri.hpp
+// ~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_DECODED_URI_HPP
+#define HTTP_DECODED_URI_HPP
+
+#include <cstddef>
+#include <boost/utility/string_view.hpp>
+
+namespace http {
+namespace server {
+
+/// The path and query parameters of a request URI after URL-decoding. Parts
+/// without escapes are views into the URI itself, decoded parts live in a
+/// fixed inline buffer, so decoding never allocates. The URI must outlive
+/// the object.
+class decoded_uri
+{
+public:
+  /// The maximum number of query parameters.
+  static const std::size_t max_params = 16;
+
+  /// The space for decoded text.
+  static const std::size_t text_capacity = 2048;
+
+  decoded_uri()
+    : text_size_(0),
+      param_count_(0)
+  {
+  }
+
+  /// The decoded path.
+  boost::string_view path() const
+  {
+    return path_;
+  }
+
+  /// Find the value of the first query parameter with the given name.
+  /// Returns false if there is none.
+  bool find(boost::string_view name, boost::string_view& value) const
+  {
+    for (std::size_t i = 0; i < param_count_; ++i)
+    {
+      if (params_[i].name == name)
+      {
+        value = params_[i].value;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// The number of query parameters.
+  std::size_t size() const
+  {
+    return param_count_;
+  }
+
+  /// Clear the path and the parameters.
+  void clear()
+  {
+    path_.clear();
+    text_size_ = 0;
+    param_count_ = 0;
+  }
+
+  /// Set the decoded path.
+  void set_path(boost::string_view path)
+  {
+    path_ = path;
+  }
+
+  /// Add a query parameter. Returns false if there is no room left.
+  bool add_param(boost::string_view name, boost::string_view value)
+  {
+    if (param_count_ == max_params)
+      return false;
+    params_[param_count_].name = name;
+    params_[param_count_].value = value;
+    ++param_count_;
+    return true;
+  }
+
+  /// Reserve size bytes of the text buffer for decoded text. Returns null if
+  /// there is no room left.
+  char* allocate_text(std::size_t size)
+  {
+    if (size > text_capacity - text_size_)
+      return nullptr;
+    char* text = text_ + text_size_;
+    text_size_ += size;
+    return text;
+  }
+
+  /// Give back the unused tail of the last allocate_text() call.
+  void shrink_text(std::size_t unused)
+  {
+    text_size_ -= unused;
+  }
+
+private:
+  struct param
+  {
+    boost::string_view name;
+    boost::string_view value;
+  };
+
+  boost::string_view path_;
+  param params_[max_params];
+  std::size_t text_size_;
+  std::size_t param_count_;
+  char text_[text_capacity];
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_DECODED_URI_HPP
@@ -0,0 +1,338 @@
+//
+// file_cache.cpp
+// ~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "file_cache.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// The changes to a directory that make the entries of its files stale.
+const std::uint32_t watch_mask = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE |
+  IN_DELETE | IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM |
+  IN_MOVED_TO | IN_ONLYDIR;
+
+} // namespace
+
+file_cache::file::file()
+  : fd(-1),
+    size(0),
+    mtime(),
+    inode(0)
+{
+}
+
+file_cache::file::~file()
+{
+  if (fd >= 0)
+    ::close(fd);
+}
+
+std::size_t file_cache::path_hash::operator()(boost::string_view path) const
+{
+  // FNV-1a.
+  std::uint64_t hash = 14695981039346656037ull;
+  for (char c: path)
+    hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+  return static_cast<std::size_t>(hash);
+}
+
+file_cache::file_cache(const std::string& root, std::size_t capacity)
+  : root_(root),
+    shard_capacity_(std::max<std::size_t>(1, capacity / shard_count)),
+    inotify_fd_(-1),
+    stop_pipe_{-1, -1}
+{
+  // Without notifications cached entries could go stale, so the cache is
+  // off if they are not available.
+  if (::pipe2(stop_pipe_, O_CLOEXEC) != 0)
+    return;
+  inotify_fd_ = ::inotify_init1(IN_CLOEXEC);
+  if (inotify_fd_ < 0)
+    return;
+  watcher_ = std::thread(&file_cache::run_watcher, this);
+}
+
+file_cache::~file_cache()
+{
+  if (stop_pipe_[1] >= 0)
+    ::close(stop_pipe_[1]);
+  if (watcher_.joinable())
+    watcher_.join();
+  if (stop_pipe_[0] >= 0)
+    ::close(stop_pipe_[0]);
+  if (inotify_fd_ >= 0)
+    ::close(inotify_fd_);
+}
+
+std::size_t file_cache::default_capacity()
+{
+  struct rlimit limit;
+  if (::getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY)
+    return 4096;
+  return std::max<std::size_t>(shard_count, limit.rlim_cur / 2);
+}
+
+file_cache::file_ptr file_cache::open(boost::string_view path)
+{
+  if (inotify_fd_ < 0)
+    return open_file(path.to_string());
+
+  shard& s = shard_for(path);
+  std::uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto i = s.index.find(path);
+    if (i != s.index.end())
+    {
+      s.lru.splice(s.lru.begin(), s.lru, i->second);
+      return *i->second;
+    }
+    generation = s.generation;
+  }
+
+  // The directory is watched before the file is opened, so that any change
+  // after the open is reported.
+  if (!watch(path))
+    return open_file(path.to_string());
+  file_ptr f = open_file(path.to_string());
+  if (!f)
+    return f;
+
+  std::lock_guard<std::mutex> lock(s.mutex);
+  if (s.generation != generation)
+    return f;
+  auto i = s.index.find(path);
+  if (i != s.index.end())
+  {
+    // Opened by another thread meanwhile.
+    s.lru.splice(s.lru.begin(), s.lru, i->second);
+    return *i->second;
+  }
+  s.lru.push_front(f);
+  s.index.emplace(boost::string_view(f->path), s.lru.begin());
+  if (s.lru.size() > shard_capacity_)
+  {
+    s.index.erase(boost::string_view(s.lru.back()->path));
+    s.lru.pop_back();
+  }
+  return f;
+}
+
+file_cache::shard& file_cache::shard_for(boost::string_view path)
+{
+  return shards_[path_hash()(path) % shard_count];
+}
+
+file_cache::file_ptr file_cache::open_file(const std::string& path) const
+{
+  // O_NONBLOCK keeps a FIFO from blocking the open; it does not affect reads
+  // of regular files.
+  std::string full_path = root_ + path;
+  int fd = ::open(full_path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+  if (fd < 0)
+    return file_ptr();
+
+  std::shared_ptr<file> f = std::make_shared<file>();
+  f->fd = fd;
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    return file_ptr();
+  f->path = path;
+  f->size = static_cast<std::uint64_t>(st.st_size);
+  f->mtime = st.st_mtim;
+  f->inode = st.st_ino;
+
+  char etag[80];
+  int n = std::snprintf(etag, sizeof(etag), "\"%llx-%llx-%llx.%lx\"",
+      static_cast<unsigned long long>(st.st_ino),
+      static_cast<unsigned long long>(st.st_size),
+      static_cast<unsigned long long>(st.st_mtim.tv_sec),
+      static_cast<unsigned long>(st.st_mtim.tv_nsec));
+  f->etag.assign(etag, n > 0 ? static_cast<std::size_t>(n) : 0);
+
+  struct tm utc;
+  char date[40];
+  if (::gmtime_r(&st.st_mtim.tv_sec, &utc))
+    f->last_modified.assign(date, std::strftime(date, sizeof(date),
+        "%a, %d %b %Y %H:%M:%S GMT", &utc));
+  return f;
+}
+
+bool file_cache::watch(boost::string_view path)
+{
+  // A file also goes stale when a directory above it is moved or removed,
+  // so the directories up to the root are watched as well. Each of them is
+  // checked: a directory below a watched one may have been replaced.
+  std::lock_guard<std::mutex> lock(watch_mutex_);
+  for (std::size_t slash = path.rfind('/'); slash != boost::string_view::npos;
+      slash = slash == 0 ? boost::string_view::npos : path.rfind('/', slash - 1))
+  {
+    std::string directory(path.data(), slash + 1);
+    if (watches_.count(directory))
+      continue;
+    int wd = ::inotify_add_watch(inotify_fd_, (root_ + directory).c_str(),
+        watch_mask);
+    if (wd < 0)
+      return false;
+    directories_.emplace(wd, directory);
+    watches_.emplace(directory, wd);
+  }
+  return true;
+}
+
+void file_cache::invalidate(boost::string_view path)
+{
+  shard& s = shard_for(path);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  ++s.generation;
+  auto i = s.index.find(path);
+  if (i != s.index.end())
+  {
+    s.lru.erase(i->second);
+    s.index.erase(i);
+  }
+}
+
+void file_cache::invalidate_all()
+{
+  for (shard& s: shards_)
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    ++s.generation;
+    s.index.clear();
+    s.lru.clear();
+  }
+}
+
+void file_cache::forget(std::string directory)
+{
+  for (auto i = watches_.begin(); i != watches_.end();)
+  {
+    if (i->first.compare(0, directory.size(), directory) != 0)
+    {
+      ++i;
+      continue;
+    }
+
+    // A directory watched by two paths, before and after a move, shares
+    // the watch descriptor; it is only removed with the last of them.
+    int wd = i->second;
+    auto range = directories_.equal_range(wd);
+    for (auto j = range.first; j != range.second; ++j)
+    {
+      if (j->second == i->first)
+      {
+        directories_.erase(j);
+        break;
+      }
+    }
+    if (directories_.count(wd) == 0)
+      ::inotify_rm_watch(inotify_fd_, wd);
+    i = watches_.erase(i);
+  }
+}
+
+void file_cache::handle_event(int wd, std::uint32_t mask, const char* name)
+{
+  // Directories that moved, vanished or were replaced are watched again,
+  // where they are now, once a file in them is opened. After an overflow
+  // any of them may have.
+  if (mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+  {
+    std::lock_guard<std::mutex> lock(watch_mutex_);
+    if (mask & IN_Q_OVERFLOW)
+    {
+      forget("/");
+    }
+    else
+    {
+      std::vector<std::string> paths;
+      auto range = directories_.equal_range(wd);
+      for (auto i = range.first; i != range.second; ++i)
+        paths.push_back(i->second);
+      for (const std::string& path: paths)
+        forget(path);
+    }
+  }
+  else if (mask & IN_ISDIR &&
+      mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))
+  {
+    std::lock_guard<std::mutex> lock(watch_mutex_);
+    std::vector<std::string> paths;
+    auto range = directories_.equal_range(wd);
+    for (auto i = range.first; i != range.second; ++i)
+      paths.push_back(i->second + name + '/');
+    for (const std::string& path: paths)
+      forget(path);
+  }
+
+  if (mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF) ||
+      (mask & IN_ISDIR && mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)))
+  {
+    invalidate_all();
+    return;
+  }
+  if (mask & IN_ISDIR || *name == '\0')
+    return;
+
+  std::lock_guard<std::mutex> lock(watch_mutex_);
+  auto range = directories_.equal_range(wd);
+  for (auto i = range.first; i != range.second; ++i)
+    invalidate(i->second + name);
+}
+
+void file_cache::run_watcher()
+{
+  alignas(struct inotify_event) char buffer[4096];
+  struct pollfd fds[2] = {
+    { inotify_fd_, POLLIN, 0 },
+    { stop_pipe_[0], POLLIN, 0 }
+  };
+  for (;;)
+  {
+    if (::poll(fds, 2, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents != 0)
+      break;
+
+    ssize_t length = ::read(inotify_fd_, buffer, sizeof(buffer));
+    if (length < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      break;
+    }
+    for (char* p = buffer; p < buffer + length;)
+    {
+      const struct inotify_event* event =
+        reinterpret_cast<const struct inotify_event*>(p);
+      handle_event(event->wd, event->mask, event->len ? event->name : "");
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,149 @@
+//
+// file_cache.hpp
+// ~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_FILE_CACHE_HPP
+#define HTTP_FILE_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <sys/types.h>
+#include <time.h>
+#include <boost/utility/string_view.hpp>
+
+namespace http {
+namespace server {
+
+/// Open descriptors and metadata of the files below a directory, so that
+/// serving a cached file takes no system call but the reads. Entries are
+/// dropped when inotify reports a change to the file or its directory, and
+/// the least recently used ones are closed to bound the number of open
+/// descriptors. Safe for concurrent use: the entries are spread over shards
+/// with a lock each.
+class file_cache
+{
+public:
+  /// An open regular file and its metadata as of the time it was opened.
+  /// The descriptor is closed once the last reference is gone.
+  struct file
+  {
+    file(const file&) = delete;
+    file& operator=(const file&) = delete;
+
+    file();
+    ~file();
+
+    /// The path below the root the file was opened by.
+    std::string path;
+
+    int fd;
+    std::uint64_t size;
+    struct timespec mtime;
+    ino_t inode;
+
+    /// The validators of the file's content, rendered once when it is
+    /// opened: a strong entity tag made of the inode, size and modification
+    /// time, and the modification time as an HTTP date.
+    std::string etag;
+    std::string last_modified;
+  };
+
+  typedef std::shared_ptr<const file> file_ptr;
+
+  file_cache(const file_cache&) = delete;
+  file_cache& operator=(const file_cache&) = delete;
+
+  /// Construct a cache of up to capacity open files below root.
+  file_cache(const std::string& root, std::size_t capacity);
+
+  /// Stop watching and close the files that are no longer referenced.
+  ~file_cache();
+
+  /// The regular file at path, which must start with '/' and contain no
+  /// empty, "." or ".." segments. Returns null if there is none.
+  file_ptr open(boost::string_view path);
+
+  /// Half the process's limit on open descriptors, leaving the rest to
+  /// connections.
+  static std::size_t default_capacity();
+
+private:
+  struct path_hash
+  {
+    std::size_t operator()(boost::string_view path) const;
+  };
+
+  /// A share of the entries, most recently used first. The index keys are
+  /// views of the paths of the files they refer to. The generation counts
+  /// invalidations, so that a file opened before one is not cached after it.
+  struct shard
+  {
+    shard() : generation(0) {}
+
+    std::mutex mutex;
+    std::list<file_ptr> lru;
+    std::unordered_map<boost::string_view, std::list<file_ptr>::iterator,
+        path_hash> index;
+    std::uint64_t generation;
+  };
+
+  static const std::size_t shard_count = 16;
+
+  /// The shard path belongs in.
+  shard& shard_for(boost::string_view path);
+
+  /// Open the file at path, bypassing the cache.
+  file_ptr open_file(const std::string& path) const;
+
+  /// Watch the directory of path and the directories above it for changes.
+  /// Returns false if they cannot be watched, in which case the file must not
+  /// be cached.
+  bool watch(boost::string_view path);
+
+  /// Stop watching a directory and the directories below it, which are no
+  /// longer where their paths say: they were moved or removed, or another
+  /// directory took their place. Called with watch_mutex_ held.
+  void forget(std::string directory);
+
+  /// Drop the entries an inotify event is about.
+  void handle_event(int wd, std::uint32_t mask, const char* name);
+
+  /// Drop the entry for path, or all entries.
+  void invalidate(boost::string_view path);
+  void invalidate_all();
+
+  /// Read inotify events until the cache is destroyed.
+  void run_watcher();
+
+  std::string root_;
+  std::size_t shard_capacity_;
+  shard shards_[shard_count];
+
+  /// The inotify descriptor, or -1 if caching is off, and a pipe whose write
+  /// end is closed to stop the watcher.
+  int inotify_fd_;
+  int stop_pipe_[2];
+
+  /// The watched directories, as paths below the root ending in '/', by
+  /// watch descriptor and the other way round.
+  std::mutex watch_mutex_;
+  std::unordered_multimap<int, std::string> directories_;
+  std::unordered_map<std::string, int> watches_;
+
+  std::thread watcher_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_FILE_CACHE_HPP
@@ -0,0 +1,434 @@
+//
+// io_ring.cpp
+// ~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "io_ring.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#if defined(HTTP_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif // defined(HTTP_IO_URING)
+
+namespace http {
+namespace server {
+
+#if defined(HTTP_IO_URING)
+
+namespace {
+
+int io_uring_setup(unsigned entries, struct io_uring_params* params)
+{
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags)
+{
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+        min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int fd, unsigned opcode, const void* arg,
+    unsigned count)
+{
+  return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg,
+        count));
+}
+
+} // namespace
+
+io_ring::io_ring(boost::asio::io_context& io_context, bool enable)
+  : io_context_(io_context),
+    ring_fd_(-1),
+    event_(io_context),
+    sq_map_(MAP_FAILED),
+    sq_map_size_(0),
+    cq_map_(MAP_FAILED),
+    cq_map_size_(0),
+    sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+    sqes_size_(0),
+    sq_local_tail_(0),
+    unsubmitted_(0),
+    submit_posted_(false),
+    pending_(0),
+    stopping_(false)
+{
+  if (enable && !setup() && ring_fd_ >= 0)
+  {
+    ::close(ring_fd_);
+    ring_fd_ = -1;
+  }
+}
+
+io_ring::~io_ring()
+{
+  if (sqes_ != MAP_FAILED)
+    ::munmap(sqes_, sqes_size_);
+  if (cq_map_ != MAP_FAILED && cq_map_ != sq_map_)
+    ::munmap(cq_map_, cq_map_size_);
+  if (sq_map_ != MAP_FAILED)
+    ::munmap(sq_map_, sq_map_size_);
+  if (ring_fd_ >= 0)
+    ::close(ring_fd_);
+}
+
+bool io_ring::setup()
+{
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = 4 * queue_entries;
+  ring_fd_ = io_uring_setup(queue_entries, &params);
+  if (ring_fd_ < 0)
+    return false;
+
+  // Completions must not be dropped when the completion queue is full.
+  if (!(params.features & IORING_FEAT_NODROP))
+    return false;
+
+  sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_map_size_ = params.cq_off.cqes +
+    params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    sq_map_size_ = cq_map_size_ = std::max(sq_map_size_, cq_map_size_);
+  sq_map_ = ::mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_map_ == MAP_FAILED)
+    return false;
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    cq_map_ = sq_map_;
+  else
+    cq_map_ = ::mmap(nullptr, cq_map_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+  if (cq_map_ == MAP_FAILED)
+    return false;
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = static_cast<struct io_uring_sqe*>(::mmap(nullptr, sqes_size_,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+        IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED)
+    return false;
+
+  char* sq = static_cast<char*>(sq_map_);
+  sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_flags_ = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  char* cq = static_cast<char*>(cq_map_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+  sq_local_tail_ = *sq_tail_;
+
+  int event_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (event_fd < 0)
+    return false;
+  event_.assign(event_fd);
+  if (io_uring_register(ring_fd_, IORING_REGISTER_EVENTFD, &event_fd, 1) != 0)
+  {
+    event_.close();
+    return false;
+  }
+
+  // Registered buffers are an optimization only; the memory lock limit may
+  // not allow them.
+  buffers_.resize(buffer_count * buffer_size);
+  std::vector<struct iovec> iovecs(buffer_count);
+  for (std::size_t i = 0; i < buffer_count; ++i)
+  {
+    iovecs[i].iov_base = buffer_data(static_cast<int>(i));
+    iovecs[i].iov_len = buffer_size;
+  }
+  if (io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, iovecs.data(),
+        buffer_count) == 0)
+  {
+    for (std::size_t i = buffer_count; i > 0; --i)
+      free_buffers_.push_back(static_cast<int>(i - 1));
+  }
+  else
+  {
+    std::vector<char>().swap(buffers_);
+  }
+
+  do_wait();
+  return true;
+}
+
+bool io_ring::read(operation& op, int fd, char* data, std::size_t size,
+    std::uint64_t offset, int buffer)
+{
+  struct io_uring_sqe* sqe = next_entry();
+  if (!sqe)
+    return false;
+  sqe->opcode = buffer >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->off = offset;
+  sqe->addr = reinterpret_cast<std::uintptr_t>(data);
+  sqe->len = static_cast<unsigned>(size);
+  sqe->buf_index = static_cast<std::uint16_t>(buffer >= 0 ? buffer : 0);
+  sqe->user_data = reinterpret_cast<std::uintptr_t>(&op);
+  ++pending_;
+  push(sqe);
+  return true;
+}
+
+bool io_ring::send(operation& op, int fd, const char* data, std::size_t size)
+{
+  struct io_uring_sqe* sqe = next_entry();
+  if (!sqe)
+    return false;
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<std::uintptr_t>(data);
+  sqe->len = static_cast<unsigned>(size);
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = reinterpret_cast<std::uintptr_t>(&op);
+  ++pending_;
+  push(sqe);
+  return true;
+}
+
+void io_ring::cancel(operation& op)
+{
+  // The completion of the cancellation itself carries no operation.
+  struct io_uring_sqe* sqe = next_entry();
+  if (!sqe)
+  {
+    cancels_.push_back(&op);
+    return;
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<std::uintptr_t>(&op);
+  sqe->user_data = 0;
+  push(sqe);
+}
+
+void io_ring::queue_cancels()
+{
+  while (!cancels_.empty())
+  {
+    struct io_uring_sqe* sqe = next_entry();
+    if (!sqe)
+      return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<std::uintptr_t>(cancels_.back());
+    sqe->user_data = 0;
+    cancels_.pop_back();
+    push(sqe);
+  }
+}
+
+struct io_uring_sqe* io_ring::next_entry()
+{
+  if (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >=
+      sq_entries_)
+  {
+    submit();
+    if (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >=
+        sq_entries_)
+      return nullptr;
+  }
+  struct io_uring_sqe* sqe = &sqes_[sq_local_tail_ & sq_mask_];
+  std::memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+void io_ring::push(struct io_uring_sqe* sqe)
+{
+  sq_array_[sq_local_tail_ & sq_mask_] = static_cast<unsigned>(sqe - sqes_);
+  ++sq_local_tail_;
+  ++unsubmitted_;
+  __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+  // Everything queued by the handlers that run until then goes in one call.
+  if (!submit_posted_)
+  {
+    submit_posted_ = true;
+    boost::asio::post(io_context_,
+        [this]()
+        {
+          submit_posted_ = false;
+          submit();
+        });
+  }
+}
+
+void io_ring::submit()
+{
+  while (unsubmitted_ > 0)
+  {
+    int submitted = io_uring_enter(ring_fd_, unsubmitted_, 0, 0);
+    if (submitted < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      // Out of resources for now: the completions of the operations in
+      // flight free them, and the submission is retried after those.
+      if (errno == EAGAIN || errno == EBUSY)
+        return;
+
+      // The kernel will not take the entries: take them back off the queue,
+      // which it has not looked at past its head, and fail their operations
+      // as their completions would.
+      int error = errno;
+      sq_local_tail_ -= unsubmitted_;
+      __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+      for (unsigned i = 0; i < unsubmitted_; ++i)
+      {
+        operation* op = reinterpret_cast<operation*>(
+            sqes_[(sq_local_tail_ + i) & sq_mask_].user_data);
+        if (!op)
+          continue;
+        --pending_;
+        boost::asio::post(io_context_,
+            [op, error]()
+            {
+              op->complete(-error);
+            });
+      }
+      unsubmitted_ = 0;
+      return;
+    }
+    unsubmitted_ -= static_cast<unsigned>(submitted);
+  }
+}
+
+void io_ring::do_wait()
+{
+  event_.async_wait(boost::asio::posix::stream_descriptor::wait_read,
+      [this](boost::system::error_code ec)
+      {
+        if (ec)
+          return;
+        std::uint64_t count;
+        ssize_t ignored = ::read(event_.native_handle(), &count,
+            sizeof(count));
+        (void)ignored;
+        reap();
+        if (stopping_ && pending_ == 0)
+          event_.close();
+        else
+          do_wait();
+      });
+}
+
+void io_ring::reap()
+{
+  for (;;)
+  {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    if (head == tail)
+    {
+      // Completions that did not fit into the queue are held back by the
+      // kernel until asked for.
+      if (__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)
+      {
+        io_uring_enter(ring_fd_, 0, 0, IORING_ENTER_GETEVENTS);
+        continue;
+      }
+      break;
+    }
+    const struct io_uring_cqe& cqe = cqes_[head & cq_mask_];
+    operation* op = reinterpret_cast<operation*>(cqe.user_data);
+    int result = cqe.res;
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    if (op)
+    {
+      --pending_;
+      // A cancellation still waiting for room is moot once the operation is
+      // done, and must not hit the next operation of the same object.
+      if (!cancels_.empty())
+        cancels_.erase(std::remove(cancels_.begin(), cancels_.end(), op),
+            cancels_.end());
+      op->complete(result);
+    }
+  }
+  submit();
+  queue_cancels();
+}
+
+int io_ring::acquire_buffer()
+{
+  if (free_buffers_.empty())
+    return -1;
+  int buffer = free_buffers_.back();
+  free_buffers_.pop_back();
+  return buffer;
+}
+
+void io_ring::release_buffer(int buffer)
+{
+  free_buffers_.push_back(buffer);
+}
+
+void io_ring::stop()
+{
+  stopping_ = true;
+  if (pending_ == 0)
+  {
+    boost::system::error_code ignored_ec;
+    event_.close(ignored_ec);
+  }
+}
+
+#else // defined(HTTP_IO_URING)
+
+io_ring::io_ring(boost::asio::io_context& io_context, bool)
+  : io_context_(io_context),
+    ring_fd_(-1),
+    event_(io_context)
+{
+}
+
+io_ring::~io_ring()
+{
+}
+
+bool io_ring::read(operation&, int, char*, std::size_t, std::uint64_t, int)
+{
+  return false;
+}
+
+bool io_ring::send(operation&, int, const char*, std::size_t)
+{
+  return false;
+}
+
+void io_ring::cancel(operation&)
+{
+}
+
+int io_ring::acquire_buffer()
+{
+  return -1;
+}
+
+void io_ring::release_buffer(int)
+{
+}
+
+void io_ring::stop()
+{
+}
+
+#endif // defined(HTTP_IO_URING)
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,175 @@
+//
+// io_ring.hpp
+// ~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_IO_RING_HPP
+#define HTTP_IO_RING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <boost/asio.hpp>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace http {
+namespace server {
+
+/// An io_uring submission and completion queue pair serving one worker.
+/// Operations queued while the worker's handlers run are submitted together
+/// by a single system call once they are done; completions are announced on
+/// an eventfd that the io_context waits on, so they are handled on the
+/// worker's thread like any other completion. A set of buffers is registered
+/// with the kernel, so that reads into them skip mapping the pages on every
+/// call. Not thread-safe: the ring belongs to a single io_context thread.
+///
+/// Where io_uring is not available, enabled() is false and the caller does
+/// its I/O the usual way.
+class io_ring
+{
+public:
+  /// An operation in the ring. It must stay valid until completed.
+  class operation
+  {
+  public:
+    /// Called with the result of the operation: the number of bytes
+    /// transferred, or a negated errno value.
+    virtual void complete(int result) = 0;
+
+  protected:
+    ~operation() {}
+  };
+
+  io_ring(const io_ring&) = delete;
+  io_ring& operator=(const io_ring&) = delete;
+
+  /// Construct a ring on the io_context; if enable is false or the ring
+  /// cannot be set up, the ring is disabled.
+  io_ring(boost::asio::io_context& io_context, bool enable);
+
+  ~io_ring();
+
+  /// Whether operations may be queued.
+  bool enabled() const
+  {
+    return ring_fd_ >= 0;
+  }
+
+  /// Queue a read of up to size bytes from fd at offset into data. If data
+  /// lies in a registered buffer, buffer is its index, otherwise -1.
+  /// Returns false if the submission queue is full and cannot be drained,
+  /// in which case the caller does the read some other way.
+  bool read(operation& op, int fd, char* data, std::size_t size,
+      std::uint64_t offset, int buffer);
+
+  /// Queue a send of up to size bytes to a socket. Returns false if the
+  /// submission queue is full, as above.
+  bool send(operation& op, int fd, const char* data, std::size_t size);
+
+  /// Ask for a queued operation to complete early with -ECANCELED. Without
+  /// room in the submission queue the request is queued after the next
+  /// completions.
+  void cancel(operation& op);
+
+  /// The size of a registered buffer.
+  static const std::size_t buffer_size = 32768;
+
+  /// Take a registered buffer. Returns its index, or -1 if none is free.
+  int acquire_buffer();
+
+  /// The memory of a registered buffer.
+  char* buffer_data(int buffer)
+  {
+    return buffers_.data() + buffer * buffer_size;
+  }
+
+  /// Return a registered buffer; no operation may be using it.
+  void release_buffer(int buffer);
+
+  /// Stop waiting for completions once the operations in flight are done.
+  void stop();
+
+private:
+  /// Set up the ring, returning false on failure.
+  bool setup();
+
+  /// Get a free submission queue entry, submitting the queued ones first if
+  /// there is none. Returns null if the kernel takes none of them for now.
+  ::io_uring_sqe* next_entry();
+
+  /// Queue an entry, making sure the queue is submitted soon.
+  void push(::io_uring_sqe* sqe);
+
+  /// Submit the queued entries. Entries the kernel cannot take for now stay
+  /// queued; on any other error they are taken back and their operations
+  /// complete with the error.
+  void submit();
+
+  /// Queue the cancellations that found no room, as far as there is room.
+  void queue_cancels();
+
+  /// Wait for the eventfd to announce completions.
+  void do_wait();
+
+  /// Handle the available completions.
+  void reap();
+
+  static const unsigned queue_entries = 256;
+  static const std::size_t buffer_count = 64;
+
+  boost::asio::io_context& io_context_;
+  int ring_fd_;
+
+  /// The eventfd the kernel signals completions on.
+  boost::asio::posix::stream_descriptor event_;
+
+  /// The mapped rings.
+  void* sq_map_;
+  std::size_t sq_map_size_;
+  void* cq_map_;
+  std::size_t cq_map_size_;
+  ::io_uring_sqe* sqes_;
+  std::size_t sqes_size_;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_flags_;
+  unsigned* sq_array_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  ::io_uring_cqe* cqes_;
+
+  /// The tail of the entries queued so far, and how many of them have not
+  /// been submitted.
+  unsigned sq_local_tail_;
+  unsigned unsubmitted_;
+
+  /// Whether a submission is posted to the io_context.
+  bool submit_posted_;
+
+  /// The number of operations in flight.
+  std::size_t pending_;
+
+  /// The operations whose cancellation is still to be queued.
+  std::vector<operation*> cancels_;
+
+  bool stopping_;
+
+  /// The registered buffers, or empty if they could not be registered, and
+  /// the indexes of the free ones.
+  std::vector<char> buffers_;
+  std::vector<int> free_buffers_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_IO_RING_HPP
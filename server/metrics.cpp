@@ -0,0 +1,281 @@
+//
+// metrics.cpp
+// ~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "metrics.hpp"
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// The names of the stages in the exported metrics.
+const char* const stage_names[metrics::stage_count] = {
+  "parse",
+  "url_decode",
+  "client_lookup",
+  "file_open",
+  "file_read",
+  "encrypt",
+  "write"
+};
+
+/// The exported histogram buckets end at 2^k and 1.5 * 2^k nanoseconds for k
+/// in [first_octave, last_octave], which spans about 1 us to 26 s.
+const std::size_t first_octave = 10;
+const std::size_t last_octave = 34;
+
+/// The length of a tick of metrics::now() in nanoseconds, measured against
+/// the steady clock at startup.
+double measure_tick()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  typedef std::chrono::steady_clock clock;
+  clock::time_point begin = clock::now();
+  metrics::time_point first = metrics::now();
+  clock::time_point end;
+  do
+  {
+    end = clock::now();
+  } while (end - begin < std::chrono::milliseconds(1));
+  metrics::time_point last = metrics::now();
+  double ns =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+  return last > first ? ns / (last - first) : 1.0;
+#else
+  return 1.0;
+#endif
+}
+
+const double tick_ns = measure_tick();
+
+void append_number(std::string& out, const char* format, double value)
+{
+  char buffer[32];
+  int n = std::snprintf(buffer, sizeof(buffer), format, value);
+  out.append(buffer, n > 0 ? static_cast<std::size_t>(n) : 0);
+}
+
+void append_count(std::string& out, std::uint64_t value)
+{
+  char buffer[24];
+  int n = std::snprintf(buffer, sizeof(buffer), "%llu",
+      static_cast<unsigned long long>(value));
+  out.append(buffer, n > 0 ? static_cast<std::size_t>(n) : 0);
+}
+
+} // namespace
+
+struct metrics::registry
+{
+  std::mutex mutex;
+  std::vector<std::unique_ptr<shard>> shards;
+};
+
+const std::size_t metrics::histogram::bucket_count;
+const int metrics::min_status;
+const int metrics::max_status;
+
+std::size_t metrics::histogram::bucket(std::uint64_t ns)
+{
+  if (ns < 4)
+    return static_cast<std::size_t>(ns);
+  std::size_t exponent = 63 - __builtin_clzll(ns);
+  std::size_t b = (exponent - 1) * 4 + ((ns >> (exponent - 2)) & 3);
+  return b < bucket_count ? b : bucket_count - 1;
+}
+
+std::uint64_t metrics::histogram::lower_bound(std::size_t bucket)
+{
+  if (bucket < 4)
+    return bucket;
+  std::size_t exponent = bucket / 4 + 1;
+  return static_cast<std::uint64_t>(4 + bucket % 4) << (exponent - 2);
+}
+
+metrics::shard::shard()
+{
+  for (histogram& h: stages)
+  {
+    for (std::atomic<std::uint64_t>& b: h.buckets)
+      b.store(0, std::memory_order_relaxed);
+    h.sum.store(0, std::memory_order_relaxed);
+  }
+  for (std::atomic<std::uint64_t>& s: statuses)
+    s.store(0, std::memory_order_relaxed);
+  bytes_in.store(0, std::memory_order_relaxed);
+  bytes_out.store(0, std::memory_order_relaxed);
+  connections.store(0, std::memory_order_relaxed);
+}
+
+metrics::registry& metrics::shards()
+{
+  static registry r;
+  return r;
+}
+
+metrics::shard& metrics::local()
+{
+  static thread_local shard* s = nullptr;
+  if (!s)
+  {
+    registry& r = shards();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.shards.emplace_back(new shard);
+    s = r.shards.back().get();
+  }
+  return *s;
+}
+
+std::uint64_t metrics::nanoseconds(time_point start, time_point end)
+{
+  // A thread moved to another core may see a slightly earlier time.
+  return end > start ? static_cast<std::uint64_t>((end - start) * tick_ns) : 0;
+}
+
+metrics::time_point metrics::record(stage s, time_point start)
+{
+  time_point end = now();
+  std::uint64_t value = nanoseconds(start, end);
+  histogram& h = local().stages[s];
+  add(h.buckets[histogram::bucket(value)], std::uint64_t(1));
+  add(h.sum, value);
+  return end;
+}
+
+void metrics::count_status(int status)
+{
+  if (status >= min_status && status <= max_status)
+    add(local().statuses[status - min_status], std::uint64_t(1));
+}
+
+void metrics::count_bytes_in(std::size_t bytes)
+{
+  add(local().bytes_in, std::uint64_t(bytes));
+}
+
+void metrics::count_bytes_out(std::size_t bytes)
+{
+  add(local().bytes_out, std::uint64_t(bytes));
+}
+
+void metrics::connection_opened()
+{
+  add(local().connections, std::int64_t(1));
+}
+
+void metrics::connection_closed()
+{
+  add(local().connections, std::int64_t(-1));
+}
+
+void metrics::write_text(std::string& out)
+{
+  // Sum up the threads' counters. A thread may be halfway through an update,
+  // which then shows up in the next export.
+  std::vector<std::uint64_t> buckets(stage_count * histogram::bucket_count);
+  std::vector<std::uint64_t> sums(stage_count);
+  std::vector<std::uint64_t> statuses(max_status - min_status + 1);
+  std::uint64_t bytes_in = 0;
+  std::uint64_t bytes_out = 0;
+  std::int64_t connections = 0;
+  {
+    registry& r = shards();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (const std::unique_ptr<shard>& s: r.shards)
+    {
+      for (std::size_t i = 0; i < stage_count; ++i)
+      {
+        const histogram& h = s->stages[i];
+        for (std::size_t b = 0; b < histogram::bucket_count; ++b)
+          buckets[i * histogram::bucket_count + b] +=
+            h.buckets[b].load(std::memory_order_relaxed);
+        sums[i] += h.sum.load(std::memory_order_relaxed);
+      }
+      for (std::size_t i = 0; i < statuses.size(); ++i)
+        statuses[i] += s->statuses[i].load(std::memory_order_relaxed);
+      bytes_in += s->bytes_in.load(std::memory_order_relaxed);
+      bytes_out += s->bytes_out.load(std::memory_order_relaxed);
+      connections += s->connections.load(std::memory_order_relaxed);
+    }
+  }
+
+  out += "# HELP http_requests_total Replies sent, by status code.\n"
+    "# TYPE http_requests_total counter\n";
+  for (std::size_t i = 0; i < statuses.size(); ++i)
+  {
+    if (statuses[i] == 0)
+      continue;
+    out += "http_requests_total{code=\"";
+    append_count(out, min_status + i);
+    out += "\"} ";
+    append_count(out, statuses[i]);
+    out += '\n';
+  }
+
+  out += "# HELP http_received_bytes_total Bytes received from clients.\n"
+    "# TYPE http_received_bytes_total counter\n"
+    "http_received_bytes_total ";
+  append_count(out, bytes_in);
+  out += "\n# HELP http_sent_bytes_total Bytes sent to clients.\n"
+    "# TYPE http_sent_bytes_total counter\n"
+    "http_sent_bytes_total ";
+  append_count(out, bytes_out);
+  out += "\n# HELP http_connections Open client connections.\n"
+    "# TYPE http_connections gauge\n"
+    "http_connections ";
+  append_count(out, connections > 0 ? connections : 0);
+
+  out += "\n# HELP http_stage_duration_seconds Time spent in each stage of "
+    "handling requests.\n"
+    "# TYPE http_stage_duration_seconds histogram\n";
+  for (std::size_t i = 0; i < stage_count; ++i)
+  {
+    const std::uint64_t* b = &buckets[i * histogram::bucket_count];
+    std::uint64_t cumulative = 0;
+    std::size_t next = 0;
+    for (std::size_t octave = first_octave; octave <= last_octave; ++octave)
+    {
+      // Bucket 4 * (k - 1) starts at 2^k, bucket 4 * (k - 1) + 2 at 1.5 * 2^k.
+      for (std::size_t half = 0; half < 2; ++half)
+      {
+        std::size_t end = 4 * (octave - 1) + 2 * half;
+        for (; next < end; ++next)
+          cumulative += b[next];
+        out += "http_stage_duration_seconds_bucket{stage=\"";
+        out += stage_names[i];
+        out += "\",le=\"";
+        append_number(out, "%.6g", histogram::lower_bound(end) * 1e-9);
+        out += "\"} ";
+        append_count(out, cumulative);
+        out += '\n';
+      }
+    }
+    for (; next < histogram::bucket_count; ++next)
+      cumulative += b[next];
+    out += "http_stage_duration_seconds_bucket{stage=\"";
+    out += stage_names[i];
+    out += "\",le=\"+Inf\"} ";
+    append_count(out, cumulative);
+    out += "\nhttp_stage_duration_seconds_sum{stage=\"";
+    out += stage_names[i];
+    out += "\"} ";
+    append_number(out, "%.9g", sums[i] * 1e-9);
+    out += "\nhttp_stage_duration_seconds_count{stage=\"";
+    out += stage_names[i];
+    out += "\"} ";
+    append_count(out, cumulative);
+    out += '\n';
+  }
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,134 @@
+//
+// metrics.hpp
+// ~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_METRICS_HPP
+#define HTTP_METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace http {
+namespace server {
+
+/// Counters and latency histograms of the server, kept per thread. Each thread
+/// only ever writes its own counters, with plain loads and stores rather than
+/// locked instructions; they are summed up when the metrics are exported, in
+/// the Prometheus text format. The counters of threads that have exited are
+/// kept. Times are taken from the time stamp counter where there is one,
+/// which is read without entering the kernel or the vDSO.
+class metrics
+{
+public:
+  /// The stages of handling a request that are timed.
+  enum stage
+  {
+    parse,
+    url_decode,
+    client_lookup,
+    file_open,
+    file_read,
+    encrypt,
+    write,
+    stage_count
+  };
+
+  /// A point in time, in ticks of an unspecified clock.
+  typedef std::uint64_t time_point;
+
+  /// The current time.
+  static time_point now()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  /// The nanoseconds from start to end, or 0 if end is not later.
+  static std::uint64_t nanoseconds(time_point start, time_point end);
+
+  /// Record the time from start until now spent in stage s. Returns now, the
+  /// start of whatever comes next.
+  static time_point record(stage s, time_point start);
+
+  /// Count a reply with the given status code.
+  static void count_status(int status);
+
+  /// Count bytes received from and sent to clients.
+  static void count_bytes_in(std::size_t bytes);
+  static void count_bytes_out(std::size_t bytes);
+
+  /// Track the number of open connections.
+  static void connection_opened();
+  static void connection_closed();
+
+  /// Append the metrics of all threads to out.
+  static void write_text(std::string& out);
+
+private:
+  /// A log-linear histogram of nanoseconds: every power of two is split into
+  /// four buckets, so a value is known to within 25%.
+  struct histogram
+  {
+    /// The bucket of a value.
+    static std::size_t bucket(std::uint64_t ns);
+
+    /// The smallest value of a bucket.
+    static std::uint64_t lower_bound(std::size_t bucket);
+
+    /// Values of 2^40 ns (about 18 minutes) and more share the last bucket.
+    static const std::size_t bucket_count = 4 * 39;
+
+    std::atomic<std::uint64_t> buckets[bucket_count];
+    std::atomic<std::uint64_t> sum;
+  };
+
+  /// The status codes counted, 100 to 599.
+  static const int min_status = 100;
+  static const int max_status = 599;
+
+  /// The counters of one thread.
+  struct shard
+  {
+    shard();
+
+    histogram stages[stage_count];
+    std::atomic<std::uint64_t> statuses[max_status - min_status + 1];
+    std::atomic<std::uint64_t> bytes_in;
+    std::atomic<std::uint64_t> bytes_out;
+    std::atomic<std::int64_t> connections;
+  };
+
+  /// The counters of all threads.
+  struct registry;
+  static registry& shards();
+
+  /// The counters of the calling thread, created on first use.
+  static shard& local();
+
+  /// Add n to a counter only the calling thread writes.
+  template <typename T>
+  static void add(std::atomic<T>& counter, T n)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+        std::memory_order_relaxed);
+  }
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_METRICS_HPP
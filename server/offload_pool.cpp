@@ -0,0 +1,106 @@
+//
+// offload_pool.cpp
+// ~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "offload_pool.hpp"
+
+namespace http {
+namespace server {
+
+offload_pool::offload_pool(std::size_t threads, std::size_t capacity)
+  : capacity_(capacity),
+    size_(0),
+    next_(0),
+    stopped_(false)
+{
+  for (std::size_t i = 0; i < threads; ++i)
+    queues_.emplace_back(new queue);
+  for (std::size_t i = 0; i < threads; ++i)
+    threads_.emplace_back(&offload_pool::run, this, i);
+}
+
+offload_pool::~offload_pool()
+{
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    stopped_ = true;
+  }
+  idle_.notify_all();
+  for (std::thread& t: threads_)
+    t.join();
+}
+
+bool offload_pool::post(task& t)
+{
+  if (queues_.empty())
+    return false;
+  if (size_.fetch_add(1, std::memory_order_relaxed) >= capacity_)
+  {
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  queue& q = *queues_[next_.fetch_add(1, std::memory_order_relaxed) %
+    queues_.size()];
+  {
+    std::lock_guard<std::mutex> lock(q.mutex);
+    t.next_ = nullptr;
+    if (q.tail)
+      q.tail->next_ = &t;
+    else
+      q.head = &t;
+    q.tail = &t;
+  }
+
+  // Taking the lock orders the wakeup after a thread's check for tasks.
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+  }
+  idle_.notify_one();
+  return true;
+}
+
+offload_pool::task* offload_pool::take(std::size_t index)
+{
+  for (std::size_t i = 0; i < queues_.size(); ++i)
+  {
+    queue& q = *queues_[(index + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    task* t = q.head;
+    if (t)
+    {
+      q.head = t->next_;
+      if (!q.head)
+        q.tail = nullptr;
+      size_.fetch_sub(1, std::memory_order_relaxed);
+      return t;
+    }
+  }
+  return nullptr;
+}
+
+void offload_pool::run(std::size_t index)
+{
+  for (;;)
+  {
+    if (task* t = take(index))
+    {
+      t->run();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    if (size_.load(std::memory_order_relaxed) != 0)
+      continue;
+    if (stopped_)
+      return;
+    idle_.wait(lock);
+  }
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,101 @@
+//
+// offload_pool.hpp
+// ~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_OFFLOAD_POOL_HPP
+#define HTTP_OFFLOAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace http {
+namespace server {
+
+/// Threads for blocking work, such as reading files and encrypting them, that
+/// must not hold up the workers' event loops. Each thread has a queue of its
+/// own that tasks are dealt out to in turn; a thread whose queue is empty
+/// takes tasks from the others. The number of queued tasks is bounded, so
+/// that a backlog shows up at the caller instead of growing without limit.
+/// Tasks are intrusive and never copied; posting one allocates nothing.
+class offload_pool
+{
+public:
+  /// A unit of work. It must stay valid until run() is called.
+  class task
+  {
+  public:
+    task() : next_(nullptr) {}
+
+    /// Do the work on a thread of the pool.
+    virtual void run() = 0;
+
+  protected:
+    ~task() {}
+
+  private:
+    friend class offload_pool;
+    task* next_;
+  };
+
+  offload_pool(const offload_pool&) = delete;
+  offload_pool& operator=(const offload_pool&) = delete;
+
+  /// Start the given number of threads, queueing up to capacity tasks. With
+  /// no threads every post() fails.
+  offload_pool(std::size_t threads, std::size_t capacity);
+
+  /// Run the queued tasks and join the threads.
+  ~offload_pool();
+
+  /// Queue t to be run. Returns false if the pool is full or has no
+  /// threads, in which case the caller does the work itself.
+  bool post(task& t);
+
+private:
+  /// A queue of tasks, first in first out.
+  struct queue
+  {
+    queue() : head(nullptr), tail(nullptr) {}
+
+    std::mutex mutex;
+    task* head;
+    task* tail;
+  };
+
+  /// Take a task, from the given thread's queue first. Returns null if all
+  /// queues are empty.
+  task* take(std::size_t index);
+
+  /// Run tasks until the pool is destroyed.
+  void run(std::size_t index);
+
+  std::vector<std::unique_ptr<queue>> queues_;
+  std::size_t capacity_;
+
+  /// The number of queued tasks.
+  std::atomic<std::size_t> size_;
+
+  /// The queue the next task goes to.
+  std::atomic<std::size_t> next_;
+
+  /// Idle threads wait here for tasks.
+  std::mutex idle_mutex_;
+  std::condition_variable idle_;
+  bool stopped_;
+
+  std::vector<std::thread> threads_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_OFFLOAD_POOL_HPP
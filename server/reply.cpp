@@ -9,6 +9,7 @@
 //
 
 #include "reply.hpp"
+#include <cstring>
 #include <string>
 
 namespace http {
@@ -17,37 +18,41 @@ namespace server {
 namespace status_strings {
 
 const std::string ok =
-  "HTTP/1.0 200 OK\r\n";
+  "HTTP/1.1 200 OK\r\n";
 const std::string created =
-  "HTTP/1.0 201 Created\r\n";
+  "HTTP/1.1 201 Created\r\n";
 const std::string accepted =
-  "HTTP/1.0 202 Accepted\r\n";
+  "HTTP/1.1 202 Accepted\r\n";
 const std::string no_content =
-  "HTTP/1.0 204 No Content\r\n";
+  "HTTP/1.1 204 No Content\r\n";
+const std::string partial_content =
+  "HTTP/1.1 206 Partial Content\r\n";
 const std::string multiple_choices =
-  "HTTP/1.0 300 Multiple Choices\r\n";
+  "HTTP/1.1 300 Multiple Choices\r\n";
 const std::string moved_permanently =
-  "HTTP/1.0 301 Moved Permanently\r\n";
+  "HTTP/1.1 301 Moved Permanently\r\n";
 const std::string moved_temporarily =
-  "HTTP/1.0 302 Moved Temporarily\r\n";
+  "HTTP/1.1 302 Moved Temporarily\r\n";
 const std::string not_modified =
-  "HTTP/1.0 304 Not Modified\r\n";
+  "HTTP/1.1 304 Not Modified\r\n";
 const std::string bad_request =
-  "HTTP/1.0 400 Bad Request\r\n";
+  "HTTP/1.1 400 Bad Request\r\n";
 const std::string unauthorized =
-  "HTTP/1.0 401 Unauthorized\r\n";
+  "HTTP/1.1 401 Unauthorized\r\n";
 const std::string forbidden =
-  "HTTP/1.0 403 Forbidden\r\n";
+  "HTTP/1.1 403 Forbidden\r\n";
 const std::string not_found =
-  "HTTP/1.0 404 Not Found\r\n";
+  "HTTP/1.1 404 Not Found\r\n";
+const std::string range_not_satisfiable =
+  "HTTP/1.1 416 Range Not Satisfiable\r\n";
 const std::string internal_server_error =
-  "HTTP/1.0 500 Internal Server Error\r\n";
+  "HTTP/1.1 500 Internal Server Error\r\n";
 const std::string not_implemented =
-  "HTTP/1.0 501 Not Implemented\r\n";
+  "HTTP/1.1 501 Not Implemented\r\n";
 const std::string bad_gateway =
-  "HTTP/1.0 502 Bad Gateway\r\n";
+  "HTTP/1.1 502 Bad Gateway\r\n";
 const std::string service_unavailable =
-  "HTTP/1.0 503 Service Unavailable\r\n";
+  "HTTP/1.1 503 Service Unavailable\r\n";
 
 boost::asio::const_buffer to_buffer(reply::status_type status) {
     switch (status) {
@@ -59,6 +64,8 @@ boost::asio::const_buffer to_buffer(reply::status_type status) {
         return boost::asio::buffer(accepted);
     case reply::no_content:
         return boost::asio::buffer(no_content);
+    case reply::partial_content:
+        return boost::asio::buffer(partial_content);
     case reply::multiple_choices:
         return boost::asio::buffer(multiple_choices);
     case reply::moved_permanently:
@@ -75,6 +82,8 @@ boost::asio::const_buffer to_buffer(reply::status_type status) {
         return boost::asio::buffer(forbidden);
     case reply::not_found:
         return boost::asio::buffer(not_found);
+    case reply::range_not_satisfiable:
+        return boost::asio::buffer(range_not_satisfiable);
     case reply::internal_server_error:
         return boost::asio::buffer(internal_server_error);
     case reply::not_implemented:
@@ -95,23 +104,72 @@ namespace misc_strings {
 const char name_value_separator[] = { ':', ' ' };
 const char crlf[] = { '\r', '\n' };
 
+/// Copy size bytes to out and return the end of the copy.
+inline char* append(char* out, const void* data, std::size_t size)
+{
+  std::memcpy(out, data, size);
+  return out + size;
+}
+
 } // namespace misc_strings
 
 std::vector<boost::asio::const_buffer> reply::to_buffers()
 {
   std::vector<boost::asio::const_buffer> buffers;
-  buffers.push_back(status_strings::to_buffer(status));
-  for (std::size_t i = 0; i < headers.size(); ++i)
+  to_buffers(buffers);
+  return buffers;
+}
+
+void reply::to_buffers(std::vector<boost::asio::const_buffer>& buffers)
+{
+  if (prebuilt.size() != 0)
   {
-    header& h = headers[i];
-    buffers.push_back(boost::asio::buffer(h.name));
-    buffers.push_back(boost::asio::buffer(misc_strings::name_value_separator));
-    buffers.push_back(boost::asio::buffer(h.value));
-    buffers.push_back(boost::asio::buffer(misc_strings::crlf));
+    buffers.push_back(prebuilt);
+    return;
   }
-  buffers.push_back(boost::asio::buffer(misc_strings::crlf));
-  buffers.push_back(boost::asio::buffer(content));
-  return buffers;
+
+  boost::asio::const_buffer status_line = status_strings::to_buffer(status);
+  std::size_t size = status_line.size() + sizeof(misc_strings::crlf);
+  for (const header& h: headers)
+    size += h.name.size() + sizeof(misc_strings::name_value_separator) +
+      h.value.size() + sizeof(misc_strings::crlf);
+
+  char* out = head;
+  if (size > head_capacity)
+  {
+    head_overflow.resize(size);
+    out = &head_overflow[0];
+  }
+
+  using misc_strings::append;
+  char* p = append(out, status_line.data(), status_line.size());
+  for (const header& h: headers)
+  {
+    p = append(p, h.name.data(), h.name.size());
+    p = append(p, misc_strings::name_value_separator,
+        sizeof(misc_strings::name_value_separator));
+    p = append(p, h.value.data(), h.value.size());
+    p = append(p, misc_strings::crlf, sizeof(misc_strings::crlf));
+  }
+  append(p, misc_strings::crlf, sizeof(misc_strings::crlf));
+
+  buffers.push_back(boost::asio::buffer(out, size));
+  if (!content.empty())
+    buffers.push_back(boost::asio::buffer(content));
+  if (shared_content)
+    buffers.push_back(boost::asio::buffer(*shared_content));
+}
+
+void reply::clear()
+{
+  status = ok;
+  headers.clear();
+  content.clear();
+  shared_content.reset();
+  body.reset();
+  prebuilt = boost::asio::const_buffer();
+  client_id = -1;
+  path_hash = 0;
 }
 
 namespace stock_replies {
@@ -132,6 +190,11 @@ const char no_content[] =
   "<head><title>No Content</title></head>"
   "<body><h1>204 Content</h1></body>"
   "</html>";
+const char partial_content[] =
+  "<html>"
+  "<head><title>Partial Content</title></head>"
+  "<body><h1>206 Partial Content</h1></body>"
+  "</html>";
 const char multiple_choices[] =
   "<html>"
   "<head><title>Multiple Choices</title></head>"
@@ -172,6 +235,11 @@ const char not_found[] =
   "<head><title>Not Found</title></head>"
   "<body><h1>404 Not Found</h1></body>"
   "</html>";
+const char range_not_satisfiable[] =
+  "<html>"
+  "<head><title>Range Not Satisfiable</title></head>"
+  "<body><h1>416 Range Not Satisfiable</h1></body>"
+  "</html>";
 const char internal_server_error[] =
   "<html>"
   "<head><title>Internal Server Error</title></head>"
@@ -193,7 +261,7 @@ const char service_unavailable[] =
   "<body><h1>503 Service Unavailable</h1></body>"
   "</html>";
 
-std::string to_string(reply::status_type status) {
+const char* text(reply::status_type status) {
   switch (status) {
   case reply::ok:
     return ok;
@@ -203,6 +271,8 @@ std::string to_string(reply::status_type status) {
     return accepted;
   case reply::no_content:
     return no_content;
+  case reply::partial_content:
+    return partial_content;
   case reply::multiple_choices:
     return multiple_choices;
   case reply::moved_permanently:
@@ -219,6 +289,8 @@ std::string to_string(reply::status_type status) {
     return forbidden;
   case reply::not_found:
     return not_found;
+  case reply::range_not_satisfiable:
+    return range_not_satisfiable;
   case reply::internal_server_error:
     return internal_server_error;
   case reply::not_implemented:
@@ -234,18 +306,132 @@ std::string to_string(reply::status_type status) {
 
 } // namespace stock_replies
 
+namespace prebuilt_replies {
+
+/// A stock reply as it goes on the wire, for either kind of connection.
+struct stock
+{
+  reply::status_type status;
+  std::string keep_alive;
+  std::string close;
+};
+
+std::string render(reply::status_type status, const char* connection)
+{
+  const char* text = stock_replies::text(status);
+  boost::asio::const_buffer status_line = status_strings::to_buffer(status);
+  return std::string(static_cast<const char*>(status_line.data()),
+      status_line.size()) +
+    "Content-Length: " + std::to_string(std::strlen(text)) + "\r\n"
+    "Content-Type: text/html\r\n"
+    "Connection: " + connection + "\r\n"
+    "\r\n" +
+    text;
+}
+
+std::vector<stock> render_all()
+{
+  const reply::status_type statuses[] =
+  {
+    reply::ok, reply::created, reply::accepted, reply::no_content,
+    reply::partial_content, reply::multiple_choices,
+    reply::moved_permanently, reply::moved_temporarily, reply::not_modified,
+    reply::bad_request, reply::unauthorized, reply::forbidden,
+    reply::not_found, reply::range_not_satisfiable,
+    reply::internal_server_error, reply::not_implemented, reply::bad_gateway,
+    reply::service_unavailable
+  };
+  std::vector<stock> replies;
+  for (reply::status_type status: statuses)
+    replies.push_back(
+        stock{status, render(status, "keep-alive"), render(status, "close")});
+  return replies;
+}
+
+/// All stock replies, built once.
+const std::vector<stock> stock_replies = render_all();
+
+/// The stock reply for status, which like the stock texts falls back to 500.
+const stock& find(reply::status_type status)
+{
+  for (const stock& s: stock_replies)
+    if (s.status == status)
+      return s;
+  return find(reply::internal_server_error);
+}
+
+/// A 503 reply that closes the connection, built once.
+const std::string service_unavailable =
+  status_strings::service_unavailable +
+  "Content-Length: " +
+  std::to_string(sizeof(stock_replies::service_unavailable) - 1) + "\r\n"
+  "Content-Type: text/html\r\n"
+  "Retry-After: 1\r\n"
+  "Connection: close\r\n"
+  "\r\n" +
+  stock_replies::service_unavailable;
+
+} // namespace prebuilt_replies
+
 reply reply::stock_reply(reply::status_type status)
 {
   reply rep;
-  rep.status = status;
-  rep.content = stock_replies::to_string(status);
-  rep.headers.resize(2);
-  rep.headers[0].name = "Content-Length";
-  rep.headers[0].value = std::to_string(rep.content.size());
-  rep.headers[1].name = "Content-Type";
-  rep.headers[1].value = "text/html";
+  stock_reply(status, rep);
   return rep;
 }
 
+void reply::overloaded_reply(reply& rep)
+{
+  rep.clear();
+  rep.status = service_unavailable;
+  rep.prebuilt = boost::asio::buffer(prebuilt_replies::service_unavailable);
+}
+
+boost::asio::const_buffer reply::overloaded_buffer()
+{
+  return boost::asio::buffer(prebuilt_replies::service_unavailable);
+}
+
+void reply::stock_reply(reply::status_type status, reply& rep)
+{
+  rep.clear();
+  rep.status = status;
+  rep.prebuilt = boost::asio::buffer(prebuilt_replies::find(status).keep_alive);
+}
+
+void reply::head_only()
+{
+  content.clear();
+  shared_content.reset();
+  body.reset();
+
+  // Prebuilt replies end in their stock text.
+  if (prebuilt.size() != 0)
+    prebuilt = boost::asio::buffer(prebuilt.data(),
+        prebuilt.size() - std::strlen(stock_replies::text(status)));
+}
+
+void reply::set_keep_alive(bool keep_alive)
+{
+  if (prebuilt.size() == 0)
+  {
+    headers.emplace_back();
+    headers.back().name = "Connection";
+    headers.back().value = keep_alive ? "keep-alive" : "close";
+    return;
+  }
+
+  // Stock replies come in both variants, other prebuilt replies in the one
+  // they are meant for.
+  const prebuilt_replies::stock& s = prebuilt_replies::find(status);
+  if (!keep_alive && prebuilt.data() == s.keep_alive.data())
+  {
+    bool whole = prebuilt.size() == s.keep_alive.size();
+    prebuilt = boost::asio::buffer(s.close);
+    if (!whole)
+      head_only();
+  }
+}
+
 } // namespace server
 } // namespace http
\ No newline at end of file
@@ -11,6 +11,9 @@
 #ifndef HTTP_REPLY_HPP
 #define HTTP_REPLY_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 #include <boost/asio.hpp>
@@ -19,6 +22,45 @@
 namespace http {
 namespace server {
 
+/// A reply body that is produced chunk by chunk while the reply is being
+/// written, so that it never has to be held in memory as a whole. Producing a
+/// chunk may block; the connection may call read() and consume() on another
+/// thread than its own, but never two calls at once.
+class body_source
+{
+public:
+  virtual ~body_source() {}
+
+  /// Fill data with up to size bytes of the body. Returns the number of bytes
+  /// produced, which is less than size only at the end of the body or on error.
+  virtual std::size_t read(char* data, std::size_t size) = 0;
+
+  /// The number of bytes of the body that have not been read yet.
+  virtual std::uint64_t remaining() const = 0;
+
+  /// The descriptor of the file the body comes from, if the caller may read
+  /// it directly: instead of calling read(), it reads the next bytes from
+  /// the file at offset() and passes them to consume(). -1 otherwise.
+  virtual int file_descriptor() const
+  {
+    return -1;
+  }
+
+  /// The offset in the file of the next byte of the body.
+  virtual std::uint64_t offset() const
+  {
+    return 0;
+  }
+
+  /// Take size bytes read from the file at offset() into data as the next
+  /// part of the body, turning them into what read() would have produced.
+  virtual void consume(char* data, std::size_t size)
+  {
+    (void)data;
+    (void)size;
+  }
+};
+
 /// A reply to be sent to a client.
 struct reply
 {
@@ -29,6 +71,7 @@ struct reply
     created = 201,
     accepted = 202,
     no_content = 204,
+    partial_content = 206,
     multiple_choices = 300,
     moved_permanently = 301,
     moved_temporarily = 302,
@@ -37,6 +80,7 @@ struct reply
     unauthorized = 401,
     forbidden = 403,
     not_found = 404,
+    range_not_satisfiable = 416,
     internal_server_error = 500,
     not_implemented = 501,
     bad_gateway = 502,
@@ -49,13 +93,64 @@ struct reply
   /// The content to be sent in the reply.
   std::string content;
 
-  /// Convert the reply into a vector of buffers. The buffers do not own the
-  /// underlying memory blocks, therefore the reply object must remain valid and
-  /// not be changed until the write operation has completed.
+  /// Content shared with other replies, sent after content. The reply keeps
+  /// it alive until it is cleared.
+  std::shared_ptr<const std::string> shared_content;
+
+  /// The body to be streamed after the content, if any. The Content-Length
+  /// header must account for it.
+  std::shared_ptr<body_source> body;
+
+  /// The whole reply as it goes on the wire, if it was built in advance. The
+  /// headers and the content are not used then.
+  boost::asio::const_buffer prebuilt;
+
+  /// For the access log: the client the reply is for, or -1 if unknown, and
+  /// the hash of the path served.
+  int client_id;
+  std::uint64_t path_hash;
+
+  /// The size of the inline storage for the status line and headers.
+  static const std::size_t head_capacity = 512;
+
+  /// The status line and headers as rendered by to_buffers(). Heads that do
+  /// not fit are rendered into head_overflow instead.
+  char head[head_capacity];
+  std::string head_overflow;
+
+  /// Convert the reply into a vector of buffers: the rendered head and the
+  /// content, shared or not. The buffers do not own the underlying memory blocks, therefore
+  /// the reply object must remain valid and not be changed until the write
+  /// operation has completed. The streamed body is not part of the buffers.
   std::vector<boost::asio::const_buffer> to_buffers();
 
+  /// Append the buffers of the reply to buffers, as above.
+  void to_buffers(std::vector<boost::asio::const_buffer>& buffers);
+
+  /// Drop the content and body of the reply, keeping its headers as they
+  /// are, Content-Length included: the reply to a HEAD request.
+  void head_only();
+
+  /// Say in the reply whether the connection stays open after it.
+  void set_keep_alive(bool keep_alive);
+
+  /// Reset to an empty 200 reply for no client, keeping the allocated
+  /// storage.
+  void clear();
+
   /// Get a stock reply.
   static reply stock_reply(status_type status);
+
+  /// Turn rep into a stock reply. Stock replies are rendered once at startup
+  /// and shared by all connections.
+  static void stock_reply(status_type status, reply& rep);
+
+  /// Turn rep into the prebuilt 503 reply for shed requests, which asks the
+  /// client to retry later and closes the connection.
+  static void overloaded_reply(reply& rep);
+
+  /// The bytes of that reply, for connections shed before they are served.
+  static boost::asio::const_buffer overloaded_buffer();
 };
 
 } // namespace server
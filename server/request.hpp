@@ -12,6 +12,7 @@
 #define HTTP_REQUEST_HPP
 
 #include <string>
+#include <utility>
 #include <vector>
 #include "header.hpp"
 
@@ -26,6 +27,41 @@ struct request
   int http_version_major;
   int http_version_minor;
   std::vector<header> headers;
+
+  /// Headers dropped by clear(), kept for their storage.
+  std::vector<header> spare_headers;
+
+  /// Append an empty header, reusing the storage of a dropped one if any.
+  header& add_header()
+  {
+    if (spare_headers.empty())
+    {
+      headers.emplace_back();
+    }
+    else
+    {
+      headers.push_back(std::move(spare_headers.back()));
+      spare_headers.pop_back();
+      headers.back().name.clear();
+      headers.back().value.clear();
+    }
+    return headers.back();
+  }
+
+  /// Reset to an empty request, keeping the allocated storage for the next
+  /// one on the connection.
+  void clear()
+  {
+    method.clear();
+    uri.clear();
+    http_version_major = 0;
+    http_version_minor = 0;
+    while (!headers.empty())
+    {
+      spare_headers.push_back(std::move(headers.back()));
+      headers.pop_back();
+    }
+  }
 };
 
 } // namespace server
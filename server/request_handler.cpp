@@ -9,9 +9,18 @@
 //
 
 #include "request_handler.hpp"
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
 #include <string>
+#include <vector>
+#include <unistd.h>
+#include <boost/algorithm/string/predicate.hpp>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "access_log.hpp"
+#include "metrics.hpp"
 #include "mime_types.hpp"
 #include "reply.hpp"
 #include "request.hpp"
@@ -20,86 +29,654 @@
 namespace http {
 namespace server {
 
-request_handler::request_handler(const std::string& doc_root, const std::map<int, std::string>& clients)
-  : doc_root_(doc_root), m_clients(clients) {}
+namespace {
 
-void request_handler::handle_request(const request& req, reply& rep) {
+/// Read size bytes of a file at offset into data, timed as a file read.
+/// Returns the number of bytes read, which is less only at the end of the
+/// file or on error.
+std::size_t read_file(int fd, char* data, std::size_t size, std::uint64_t offset) {
+    metrics::time_point start = metrics::now();
+    std::size_t count = 0;
+    while (count < size) {
+        ssize_t n = ::pread(fd, data + count, size - count, offset + count);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        count += n;
+    }
+    metrics::record(metrics::file_read, start);
+    return count;
+}
+
+/// Encrypt size bytes of data as the part of the client's stream at offset,
+/// timed as encryption. The keystream is addressed by its block counter, so
+/// any offset costs the same.
+void encrypt(const Salsa20& cipher, char* data, std::size_t size, std::uint64_t offset) {
+    metrics::time_point start = metrics::now();
+    cipher.crypt(reinterpret_cast<std::uint8_t *>(data), size, offset);
+    metrics::record(metrics::encrypt, start);
+}
+
+/// Streams a file from disk, or a range of it, encrypting it chunk by chunk
+/// with the client key. Every byte is encrypted with the keystream at its
+/// offset in the file, so a range decrypts just like the same bytes of the
+/// whole file.
+class encrypted_file_body : public body_source {
+public:
+    encrypted_file_body(file_cache::file_ptr file, const Salsa20& cipher,
+                        std::uint64_t offset, std::uint64_t length)
+      : m_file(std::move(file)), m_offset(offset), m_remaining(length), m_cipher(cipher),
+        m_cache(nullptr), m_client(0) {}
+
+    /// Keep a copy of the encrypted body, which goes into the cache once the
+    /// whole body has been produced. Only for bodies of the whole file.
+    void record(response_cache& cache, int client) {
+        m_cache = &cache;
+        m_client = client;
+        m_record = std::make_shared<std::string>(m_file->size, '\0');
+    }
+
+    std::size_t read(char* data, std::size_t size) override {
+        if (size > m_remaining)
+            size = static_cast<std::size_t>(m_remaining);
+        std::size_t count = read_file(m_file->fd, data, size, m_offset);
+        consume(data, count);
+        return count;
+    }
+
+    std::uint64_t remaining() const override {
+        return m_remaining;
+    }
+
+    int file_descriptor() const override {
+        return m_file->fd;
+    }
+
+    std::uint64_t offset() const override {
+        return m_offset;
+    }
+
+    void consume(char* data, std::size_t size) override {
+        encrypt(m_cipher, data, size, m_offset);
+
+        if (m_record)
+            std::copy(data, data + size, &(*m_record)[m_offset]);
+        m_offset += size;
+        m_remaining -= size;
+        if (m_record && m_remaining == 0) {
+            m_cache->insert(m_client, *m_file, std::move(m_record));
+        }
+    }
+
+private:
+    /// Shared with the file cache; reads go by offset so that they do not
+    /// interfere with other bodies of the same file.
+    file_cache::file_ptr m_file;
+    std::uint64_t m_offset;
+    std::uint64_t m_remaining;
+
+    /// The client's entry in the client table, which outlives every reply.
+    const Salsa20& m_cipher;
+
+    /// The copy being recorded, if any, and where it goes.
+    response_cache* m_cache;
+    int m_client;
+    std::shared_ptr<std::string> m_record;
+};
+
+/// A range of bytes of a file: the offset of the first and how many.
+struct byte_range {
+    std::uint64_t first;
+    std::uint64_t length;
+};
+
+/// The most ranges served in one reply. Requests for more get the whole body.
+const std::size_t max_ranges = 16;
+
+/// What a Range header asks for.
+enum range_request {
+    /// The whole body: there is no header, it is not understood, or it
+    /// covers the whole body anyway.
+    range_none,
+
+    /// Some of the body; the ranges are filled in.
+    range_some,
+
+    /// Nothing the body has.
+    range_unsatisfiable
+};
+
+/// Parse a decimal number in [p, end) up to the first non-digit. Returns
+/// false if there is no digit or the number does not fit.
+bool parse_offset(const char*& p, const char* end, std::uint64_t& value) {
+    const char* begin = p;
+    value = 0;
+    for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+        if (value > (UINT64_MAX - 9) / 10)
+            return false;
+        value = value * 10 + (*p - '0');
+    }
+    return p != begin;
+}
+
+/// Parse the value of a Range header against a body of size bytes: "bytes="
+/// followed by comma separated specs "first-last", "first-" or "-suffix".
+/// Satisfiable ranges are clipped to the body, sorted and merged where they
+/// overlap or touch, into at most max_ranges ranges.
+range_request parse_ranges(boost::string_view value, std::uint64_t size,
+                           byte_range* ranges, std::size_t& count) {
+    static const char unit[] = "bytes=";
+    count = 0;
+    if (value.size() < sizeof(unit) - 1 ||
+        !boost::algorithm::iequals(value.substr(0, sizeof(unit) - 1), unit))
+        return range_none;
+
+    const char* p = value.data() + sizeof(unit) - 1;
+    const char* end = value.data() + value.size();
+    bool any = false;
+    while (p != end) {
+        while (p != end && (*p == ' ' || *p == '\t'))
+            ++p;
+        if (p != end && *p == ',') {
+            ++p;
+            continue;
+        }
+        if (p == end)
+            break;
+
+        std::uint64_t first, last;
+        if (*p == '-') {
+            std::uint64_t suffix;
+            if (!parse_offset(++p, end, suffix))
+                return range_none;
+            // The last suffix bytes; none of them is no range at all.
+            first = suffix == 0 ? size : suffix < size ? size - suffix : 0;
+            last = size - 1;
+        } else {
+            if (!parse_offset(p, end, first) || p == end || *p++ != '-')
+                return range_none;
+            last = UINT64_MAX;
+            if (p != end && *p >= '0' && *p <= '9') {
+                parse_offset(p, end, last);
+                if (last < first)
+                    return range_none;
+            }
+            if (last >= size)
+                last = size - 1;
+        }
+        while (p != end && (*p == ' ' || *p == '\t'))
+            ++p;
+        if (p != end && *p != ',')
+            return range_none;
+
+        any = true;
+        if (first >= size)
+            continue;
+        if (count == max_ranges)
+            return range_none;
+        ranges[count].first = first;
+        ranges[count].length = last - first + 1;
+        ++count;
+    }
+    if (!any)
+        return range_none;
+    if (count == 0)
+        return range_unsatisfiable;
+
+    std::sort(ranges, ranges + count, [](const byte_range& a, const byte_range& b) {
+        return a.first < b.first;
+    });
+    std::size_t merged = 0;
+    for (std::size_t i = 1; i < count; ++i) {
+        byte_range& last = ranges[merged];
+        if (ranges[i].first <= last.first + last.length) {
+            last.length = std::max(last.first + last.length,
+                                   ranges[i].first + ranges[i].length) - last.first;
+        } else {
+            ranges[++merged] = ranges[i];
+        }
+    }
+    count = merged + 1;
+    return count == 1 && ranges[0].length == size ? range_none : range_some;
+}
+
+/// The value of a Content-Range header for a range of a body of size bytes.
+std::string content_range(const byte_range& range, std::uint64_t size) {
+    return "bytes " + std::to_string(range.first) + "-" +
+           std::to_string(range.first + range.length - 1) + "/" + std::to_string(size);
+}
+
+/// Whether an If-None-Match header value lists etag, by the weak comparison
+/// the header calls for: a "W/" prefix is ignored.
+bool etag_matches(boost::string_view value, boost::string_view etag) {
+    while (!value.empty()) {
+        std::size_t skip = value.find_first_not_of(" \t,");
+        if (skip == boost::string_view::npos)
+            break;
+        value.remove_prefix(skip);
+        if (value[0] == '*')
+            return true;
+        if (value.starts_with("W/"))
+            value.remove_prefix(2);
+        if (value.empty() || value[0] != '"')
+            return false;
+        std::size_t end = value.find('"', 1);
+        if (end == boost::string_view::npos)
+            return false;
+        if (value.substr(0, end + 1) == etag)
+            return true;
+        value.remove_prefix(end + 1);
+    }
+    return false;
+}
+
+/// Whether a file is unchanged since the HTTP date of an If-Modified-Since
+/// header value. Dates that do not parse say nothing.
+bool not_modified_since(const std::string& value, const file_cache::file& f) {
+    // Clients mostly send back the Last-Modified they were given.
+    if (value == f.last_modified)
+        return true;
+    struct tm date = {};
+    const char* end = ::strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &date);
+    if (end == nullptr || *end != '\0')
+        return false;
+    return f.mtime.tv_sec <= ::timegm(&date);
+}
+
+/// Add the validators of a file to a reply.
+void add_validators(reply& rep, const file_cache::file& f) {
+    std::size_t n = rep.headers.size();
+    rep.headers.resize(n + 2);
+    rep.headers[n].name = "ETag";
+    rep.headers[n].value = f.etag;
+    rep.headers[n + 1].name = "Last-Modified";
+    rep.headers[n + 1].value = f.last_modified;
+}
+
+/// The boundary between the parts of a multipart/byteranges body.
+const char multipart_boundary[] = "6b1d3e29a0f4c857";
+
+/// Streams several ranges of a file as a multipart/byteranges body. The
+/// ranges are encrypted at their offsets in the file, as single ranges are;
+/// the delimiters and part headers between them are sent in the clear.
+class multipart_file_body : public body_source {
+public:
+    multipart_file_body(file_cache::file_ptr file, const Salsa20& cipher, const std::string& type,
+                        const byte_range* ranges, std::size_t count)
+      : m_file(std::move(file)), m_cipher(cipher), m_segment(0), m_done(0), m_remaining(0) {
+        for (std::size_t i = 0; i < count; ++i) {
+            add_text((i == 0 ? "--" : "\r\n--") + std::string(multipart_boundary) +
+                     "\r\nContent-Type: " + type +
+                     "\r\nContent-Range: " + content_range(ranges[i], m_file->size) + "\r\n\r\n");
+            m_segments.push_back(segment{false, ranges[i].first, ranges[i].length});
+            m_remaining += ranges[i].length;
+        }
+        add_text("\r\n--" + std::string(multipart_boundary) + "--\r\n");
+    }
+
+    std::size_t read(char* data, std::size_t size) override {
+        std::size_t count = 0;
+        while (count < size && m_segment < m_segments.size()) {
+            const segment& s = m_segments[m_segment];
+            std::size_t n = static_cast<std::size_t>(
+                    std::min<std::uint64_t>(size - count, s.length - m_done));
+            if (s.text) {
+                std::copy(&m_text[s.offset + m_done], &m_text[s.offset + m_done] + n, data + count);
+            } else {
+                std::size_t got = read_file(m_file->fd, data + count, n, s.offset + m_done);
+                encrypt(m_cipher, data + count, got, s.offset + m_done);
+                if (got < n) {
+                    m_remaining -= count + got;
+                    return count + got;
+                }
+            }
+            count += n;
+            m_done += n;
+            if (m_done == s.length) {
+                ++m_segment;
+                m_done = 0;
+            }
+        }
+        m_remaining -= count;
+        return count;
+    }
+
+    std::uint64_t remaining() const override {
+        return m_remaining;
+    }
+
+private:
+    /// A piece of the body: text from m_text or a range of the file.
+    struct segment {
+        bool text;
+        std::uint64_t offset;
+        std::uint64_t length;
+    };
+
+    void add_text(const std::string& text) {
+        m_segments.push_back(segment{true, m_text.size(), text.size()});
+        m_text += text;
+        m_remaining += text.size();
+    }
+
+    file_cache::file_ptr m_file;
+    const Salsa20& m_cipher;
+
+    /// The delimiters and part headers, one after another.
+    std::string m_text;
+    std::vector<segment> m_segments;
+
+    /// The segment being sent and how much of it is sent already.
+    std::size_t m_segment;
+    std::uint64_t m_done;
+    std::uint64_t m_remaining;
+};
+
+/// The nonce every client stream is set up with.
+const std::uint8_t nonce[8] = {'a', 'b', 'c', 'd', 'e', 'f', 'g' , 'h'};
+
+/// Parse a non-negative decimal client id. Returns false if value is not one.
+bool parse_client_id(boost::string_view value, int& id) {
+    if (value.empty() || value.size() > 9)
+        return false;
+    id = 0;
+    for (char c: value) {
+        if (c < '0' || c > '9')
+            return false;
+        id = id * 10 + (c - '0');
+    }
+    return true;
+}
+
+
+/// Values of hex digits, -1 for other characters.
+struct hex_table {
+    signed char value[256];
+
+    hex_table() {
+        std::fill(value, value + 256, -1);
+        for (int i = 0; i < 10; ++i)
+            value['0' + i] = i;
+        for (int i = 0; i < 6; ++i)
+            value['a' + i] = value['A' + i] = 10 + i;
+    }
+};
+
+const hex_table hex;
+
+/// Find the first character in [p, end) that is one of set. Runs of other
+/// characters are skipped 16 bytes at a time where SSE2 is available.
+template <std::size_t N>
+const char* find_first_of(const char* p, const char* end, const char (&set)[N]) {
+#if defined(__SSE2__) && defined(__GNUC__)
+    __m128i needles[N];
+    for (std::size_t i = 0; i < N; ++i)
+        needles[i] = _mm_set1_epi8(set[i]);
+    for (; end - p >= 16; p += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i hits = _mm_cmpeq_epi8(chunk, needles[0]);
+        for (std::size_t i = 1; i < N; ++i)
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, needles[i]));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+    for (; p != end; ++p)
+        for (char c: set)
+            if (*p == c)
+                return p;
+    return end;
+}
+
+/// Decode the URL-encoded text in [p, end) up to the first character of
+/// stops, which must contain '%' and '+'. On return p points to that
+/// character or to end. Text without escapes is returned as a view into the
+/// input, decoded text is stored in uri. Returns false if an escape is
+/// malformed or the decoded text does not fit.
+template <std::size_t N>
+bool decode_component(const char*& p, const char* end, const char (&stops)[N],
+                      decoded_uri& uri, boost::string_view& out) {
+    const char* begin = p;
+    p = find_first_of(p, end, stops);
+    if (p == end || (*p != '%' && *p != '+')) {
+        out = boost::string_view(begin, p - begin);
+        return true;
+    }
+
+    // Decoded text is never longer than its encoding, so the component up to
+    // its first stop other than an escape bounds the space needed.
+    const char* limit = p;
+    while (limit != end && (*limit == '%' || *limit == '+'))
+        limit = find_first_of(limit + 1, end, stops);
+    std::size_t reserved = limit - begin;
+    char* text = uri.allocate_text(reserved);
+    if (text == nullptr)
+        return false;
+    char* o = std::copy(begin, p, text);
+    while (p != end) {
+        if (*p == '%') {
+            if (end - p < 3)
+                return false;
+            int high = hex.value[static_cast<unsigned char>(p[1])];
+            int low = hex.value[static_cast<unsigned char>(p[2])];
+            if (high < 0 || low < 0)
+                return false;
+            *o++ = static_cast<char>(high * 16 + low);
+            p += 3;
+        } else if (*p == '+') {
+            *o++ = ' ';
+            ++p;
+        } else {
+            break;
+        }
+        const char* next = find_first_of(p, end, stops);
+        o = std::copy(p, next, o);
+        p = next;
+    }
+    uri.shrink_text(reserved - (o - text));
+    out = boost::string_view(text, o - text);
+    return true;
+}
+
+} // namespace
+
+const std::size_t request_handler::default_response_cache_size;
+
+request_handler::request_handler(const std::string& doc_root, const std::map<int, std::string>& clients,
+                                 std::size_t response_cache_size)
+  : doc_root_(doc_root), m_files(doc_root, file_cache::default_capacity()),
+    m_responses(response_cache_size), m_clients(clients, nonce) {}
+
+void request_handler::handle_request(const request& req, reply& rep, arena& storage) const {
     // Decode url to path & params
-    std::string request_path;
-    std::map<std::string, std::string> params;
-    if (!url_decode(req.uri, request_path, params)) {
-        rep = reply::stock_reply(reply::bad_request);
+    metrics::time_point time = metrics::now();
+    decoded_uri uri;
+    bool decoded = url_decode(req.uri, uri);
+    time = metrics::record(metrics::url_decode, time);
+    if (!decoded) {
+        reply::stock_reply(reply::bad_request, rep);
+        return;
+    }
+
+    // The server's own metrics are open to everyone.
+    if (uri.path() == "/metrics") {
+        rep.status = reply::ok;
+        rep.client_id = -1;
+        rep.path_hash = access_log::hash_path(uri.path().data(), uri.path().size());
+        metrics::write_text(rep.content);
+        rep.headers.resize(2);
+        rep.headers[0].name = "Content-Length";
+        rep.headers[0].value = std::to_string(rep.content.size());
+        rep.headers[1].name = "Content-Type";
+        rep.headers[1].value = "text/plain; version=0.0.4";
         return;
     }
 
-    // Read client's id & key
-    std::uint8_t client_key[16] = {0};
+    // Look up the client's key state by id
+    const Salsa20* cipher;
+    int client_id;
     {
-        int client_id;
-        if (params.find("id") == params.end()) {
-            rep = reply::stock_reply(reply::bad_request);
+        boost::string_view id;
+        if (!uri.find("id", id) || !parse_client_id(id, client_id)) {
+            reply::stock_reply(reply::bad_request, rep);
             return;
         }
-        std::stringstream tmp_stream(params["id"]);
-        tmp_stream >> client_id;
-        if (m_clients.find(client_id) == m_clients.end()) {
-            rep = reply::stock_reply(reply::bad_request);
+        cipher = m_clients.find(client_id);
+        if (cipher == nullptr) {
+            reply::stock_reply(reply::bad_request, rep);
             return;
         }
-        const std::string& ref_key = m_clients[client_id];
-        for (size_t i = 0; i < ref_key.length(); ++i)
-            client_key[i] = (std::uint8_t)ref_key[i];
     }
+    time = metrics::record(metrics::client_lookup, time);
 
     // Request path must be absolute and not contain "..".
+    boost::string_view request_path = uri.path();
     if (request_path.empty() || request_path[0] != '/' ||
-        request_path.find("..") != std::string::npos) {
-        rep = reply::stock_reply(reply::bad_request);
+        request_path.find("..") != boost::string_view::npos) {
+        reply::stock_reply(reply::bad_request, rep);
         return;
     }
 
-    // If path ends in slash (i.e. is a directory) then add "index.html".
-    if (request_path[request_path.size() - 1] == '/') {
-        request_path += "index.html";
-    }
-
     // Determine the file extension.
-    std::size_t last_slash_pos = request_path.find_last_of("/");
-    std::size_t last_dot_pos = request_path.find_last_of(".");
+    std::size_t last_slash_pos = request_path.find_last_of('/');
+    std::size_t last_dot_pos = request_path.find_last_of('.');
     std::string extension;
-    if (last_dot_pos != std::string::npos && last_dot_pos > last_slash_pos) {
-        extension = request_path.substr(last_dot_pos + 1);
+    if (last_dot_pos != boost::string_view::npos && last_dot_pos > last_slash_pos) {
+        extension.assign(request_path.data() + last_dot_pos + 1,
+                         request_path.size() - last_dot_pos - 1);
     }
 
-    // Open the file to send back.
-    std::string full_path = doc_root_ + request_path;
-    std::ifstream is(full_path.c_str(), std::ios::in | std::ios::binary);
-    if (!is) {
-        rep = reply::stock_reply(reply::not_found);
+    // Normalize the path to key the file cache: empty and "." segments are
+    // dropped. If path ends in slash (i.e. is a directory) then add
+    // "index.html".
+    static const char index_file[] = "index.html";
+    char* path = static_cast<char*>(storage.allocate(request_path.size() + sizeof(index_file), 1));
+    char* end = path;
+    for (std::size_t i = 0; i < request_path.size();) {
+        std::size_t next = request_path.find('/', i + 1);
+        if (next == boost::string_view::npos)
+            next = request_path.size();
+        boost::string_view segment = request_path.substr(i, next - i);
+        if (segment != "/" && segment != "/.")
+            end = std::copy(segment.begin(), segment.end(), end);
+        i = next;
+    }
+    if (request_path.back() == '/' || (request_path.size() >= 2 &&
+            request_path.substr(request_path.size() - 2) == "/.")) {
+        *end++ = '/';
+        end = std::copy(index_file, index_file + sizeof(index_file) - 1, end);
+        extension = "html";
+    }
+
+    // Open the file to send back. The content itself is streamed by the
+    // connection once the headers are on their way.
+    file_cache::file_ptr file = m_files.open(boost::string_view(path, end - path));
+    metrics::record(metrics::file_open, time);
+    if (!file) {
+        reply::stock_reply(reply::not_found, rep);
+        rep.client_id = client_id;
+        rep.path_hash = access_log::hash_path(path, end - path);
         return;
     }
 
-    // Fill out the reply to be sent to the client.
-    rep.status = reply::ok;
-    char buf[512];
-    while (is.read(buf, sizeof(buf)).gcount() > 0) {
-        // Encrypt content
-        for (size_t i = 0; i < 512 / Salsa20::CHUNK_SIZE; ++i) {
-            std::uint8_t nonce[8] = {'a', 'b', 'c', 'd', 'e', 'f', 'g' , 'h'};
-            Salsa20::crypt16(
-                    client_key,
-                    nonce,
-                    reinterpret_cast<std::uint8_t *>(buf+i*Salsa20::CHUNK_SIZE)
-            );
+    // The body keeps the file open once it takes it over.
+    const file_cache::file& opened = *file;
+    std::uint64_t size = file->size;
+    rep.client_id = client_id;
+    rep.path_hash = access_log::hash_path(path, end - path);
+
+    const header* if_none_match = nullptr;
+    const header* if_modified_since = nullptr;
+    const header* range = nullptr;
+    const header* if_range = nullptr;
+    for (const header& h: req.headers) {
+        if (boost::algorithm::iequals(h.name, "If-None-Match"))
+            if_none_match = &h;
+        else if (boost::algorithm::iequals(h.name, "If-Modified-Since"))
+            if_modified_since = &h;
+        else if (boost::algorithm::iequals(h.name, "Range"))
+            range = &h;
+        else if (boost::algorithm::iequals(h.name, "If-Range"))
+            if_range = &h;
+    }
+
+    // A client that has the current body already is told so before anything
+    // is read or encrypted. If-Modified-Since only counts without
+    // If-None-Match.
+    if (if_none_match ? etag_matches(if_none_match->value, file->etag)
+                      : if_modified_since && not_modified_since(if_modified_since->value, *file)) {
+        rep.status = reply::not_modified;
+        add_validators(rep, opened);
+        return;
+    }
+
+    // Ranges of the body are encrypted where they are in the file rather
+    // than from its start, so they cost no more than their own size. With
+    // If-Range they are only served if the client's copy is current, which
+    // takes the strong entity tag or the exact date.
+    byte_range ranges[max_ranges];
+    std::size_t range_count = 0;
+    range_request ranged = range_none;
+    if (range && (!if_range || if_range->value == file->etag ||
+                  if_range->value == file->last_modified))
+        ranged = parse_ranges(range->value, size, ranges, range_count);
+    if (ranged == range_unsatisfiable) {
+        rep.status = reply::range_not_satisfiable;
+        rep.headers.resize(2);
+        rep.headers[0].name = "Content-Length";
+        rep.headers[0].value = "0";
+        rep.headers[1].name = "Content-Range";
+        rep.headers[1].value = "bytes */" + std::to_string(size);
+        return;
+    }
+    if (ranged == range_some) {
+        rep.status = reply::partial_content;
+        rep.headers.resize(range_count == 1 ? 3 : 2);
+        rep.headers[0].name = "Content-Length";
+        rep.headers[1].name = "Content-Type";
+        if (range_count == 1) {
+            rep.body = std::allocate_shared<encrypted_file_body>(
+                    arena_allocator<encrypted_file_body>(storage), std::move(file), *cipher,
+                    ranges[0].first, ranges[0].length);
+            rep.headers[1].value = mime_types::extension_to_type(extension);
+            rep.headers[2].name = "Content-Range";
+            rep.headers[2].value = content_range(ranges[0], size);
+        } else {
+            rep.body = std::allocate_shared<multipart_file_body>(
+                    arena_allocator<multipart_file_body>(storage), std::move(file), *cipher,
+                    mime_types::extension_to_type(extension), ranges, range_count);
+            rep.headers[1].value = std::string("multipart/byteranges; boundary=") + multipart_boundary;
         }
-        rep.content.append(buf, is.gcount());
+        rep.headers[0].value = std::to_string(rep.body->remaining());
+        add_validators(rep, opened);
+        return;
     }
 
-    rep.headers.resize(2);
+    // Fill out the reply to be sent to the client. A cached body is sent from
+    // memory. Any other is streamed: the reads and the encryption are left to
+    // the connection, which need not do them on its own thread. A body small
+    // enough to be cached is recorded on the way and sent from the cache from
+    // then on.
+    rep.status = reply::ok;
+    rep.shared_content = m_responses.find(client_id, *file);
+    if (!rep.shared_content) {
+        std::shared_ptr<encrypted_file_body> body = std::allocate_shared<encrypted_file_body>(
+                arena_allocator<encrypted_file_body>(storage), std::move(file), *cipher, 0, size);
+        if (size > 0 && size <= m_responses.max_body_size())
+            body->record(m_responses, client_id);
+        rep.body = std::move(body);
+    }
+
+    rep.headers.resize(3);
     rep.headers[0].name = "Content-Length";
-    rep.headers[0].value = std::to_string(rep.content.size());
+    rep.headers[0].value = std::to_string(size);
     rep.headers[1].name = "Content-Type";
     rep.headers[1].value = mime_types::extension_to_type(extension);
+    rep.headers[2].name = "Accept-Ranges";
+    rep.headers[2].value = "bytes";
+    add_validators(rep, opened);
 
     /// WARNING!!! client can't resolve content-type without content-type field!
     // Encrypt header's values
@@ -135,115 +712,40 @@ void request_handler::handle_request(const request& req, reply& rep) {
 //    }
 }
 
-bool request_handler::url_decode(
-        const std::string& in,
-        std::string& out,
-        std::map<std::string, std::string>& smap
-) {
-    out.clear();
-    out.reserve(in.size());
-    std::size_t ind = 0;
-
-    bool (*read_str_before)(
-            const std::string& src,
-            const std::size_t spos,
-            std::string& value,
-            const std::string& ends,
-            const std::string& errs
-    ) = [] (
-            const std::string& src,
-            const std::size_t spos,
-            std::string& value,
-            const std::string& ends,
-            const std::string& errs
-    ) -> bool {
-        value.clear();
-        std::size_t suppos = src.length();
-        for (char end: ends) {
-            std::size_t tmppos = src.find(end, spos+1);
-            if (tmppos != std::string::npos && suppos > tmppos)
-                suppos = tmppos;
-        }
+bool request_handler::url_decode(boost::string_view in, decoded_uri& out) {
+    static const char path_stops[] = {'?', '#', '%', '+'};
+    static const char name_stops[] = {'=', '&', '#', '?', '/', '%', '+'};
+    static const char value_stops[] = {'&', '#', '?', '/', '%', '+'};
 
-        for (size_t i = spos; i < suppos; ++i)
-            value.push_back(src[i]);
+    out.clear();
+    const char* p = in.data();
+    const char* end = p + in.size();
 
-        for (char err: errs)
-            if (err == '\0' && suppos == src.length() ||
-                value.find(err) != std::string::npos)
-                return true;
+    boost::string_view path;
+    if (!decode_component(p, end, path_stops, out, path))
         return false;
-    };
+    out.set_path(path);
 
-    bool (*decode_hex)(
-            const std::string& src,
-            std::string& res
-    ) = [](
-            const std::string& src,
-            std::string& res
-    ) -> bool {
-        std::string tmp;
-        for (std::size_t i = 0; i < src.size(); ++i) {
-            if (src[i] == '%') {
-                if (i + 3 <= src.size()) {
-                    int value = 0;
-                    std::istringstream is(src.substr(i + 1, 2));
-
-                    if (is >> std::hex >> value) {
-                        tmp += static_cast<char>(value);
-                        i += 2;
-                    } else
-                        return true;
-                } else
-                    return true;
-            } else if (src[i] == '+') tmp += ' ';
-            else tmp += src[i];
-        }
+    // Everything from '#' on is a fragment, which is not part of the path.
+    if (p == end || *p == '#')
+        return true;
 
-        res = tmp;
-        return false;
-    };
+    // Query parameters: name=value pairs separated by '&'.
+    for (++p; p != end && *p != '#';) {
+        boost::string_view name;
+        boost::string_view value;
+
+        if (!decode_component(p, end, name_stops, out, name) || p == end || *p != '=')
+            return false;
+        ++p;
+        if (!decode_component(p, end, value_stops, out, value) ||
+            (p != end && (*p == '?' || *p == '/')))
+            return false;
+        if (!out.add_param(name, value))
+            return false;
 
-    std::string tmp;
-    bool err_flag;
-    err_flag = read_str_before(in, ind, tmp, {'?', '\0', '#'}, {});
-    ind += tmp.length();
-    err_flag |= decode_hex(tmp, tmp);
-    if (err_flag) return false;
-    out += tmp;
-
-    if (in[ind] == '?') {
-        ++ind;
-        do {
-            std::string key;
-            std::string value;
-
-            //read key
-            err_flag = read_str_before(in, ind, key, {'='}, {'&', '#', '\0', '?', '/'});
-            err_flag |= decode_hex(key, key);
-            if (err_flag) return false;
-            ind += key.length()+1;
-            if (ind >= in.size()) return false;
-
-            //read value
-            err_flag = read_str_before(in, ind, value, {'\0', '&', '#'}, {'?', '/'});
-            err_flag |= decode_hex(value, value);
-            if (err_flag) return false;
-            ind += value.length() + 1;
-
-            //insert (key, value) pair
-            auto it = smap.find(key);
-            if (it == smap.end())
-                smap[key] = value;
-        } while (ind < in.size() && in[ind] != '#');
-    }
-
-    if (in[ind] == '#') {
-        out += in[ind++];
-        std::string tmp;
-        err_flag = decode_hex(in, tmp);
-        if (err_flag) return false;
-        out += tmp;
+        if (p != end && *p == '&')
+            ++p;
     }
 
     return true;
@@ -13,6 +13,12 @@
 
 #include <string>
 #include <map>
+#include <boost/utility/string_view.hpp>
+#include "arena.hpp"
+#include "client_table.hpp"
+#include "decoded_uri.hpp"
+#include "file_cache.hpp"
+#include "response_cache.hpp"
 
 namespace http {
 namespace server {
@@ -26,23 +32,37 @@ public:
     request_handler(const request_handler&) = delete;
     request_handler& operator=(const request_handler&) = delete;
 
-    /// Construct with a directory containing files to be served.
-    explicit request_handler(const std::string& doc_root, const std::map<int, std::string>& clients);
+    /// Construct with a directory containing files to be served, keeping up
+    /// to response_cache_size bytes of encrypted bodies in memory.
+    explicit request_handler(const std::string& doc_root, const std::map<int, std::string>& clients,
+                             std::size_t response_cache_size = default_response_cache_size);
 
-    /// Handle a request and produce a reply.
-    void handle_request(const request& req, reply& rep);
+    /// The default budget of the response cache.
+    static const std::size_t default_response_cache_size = 64 << 20;
+
+    /// Handle a request and produce a reply. Storage the reply refers to is
+    /// taken from the given arena, which must not be reset before the reply
+    /// has been sent. The handler is never modified after construction but
+    /// for its file cache, which is synchronized, so it may be called from
+    /// several threads at once.
+    void handle_request(const request& req, reply& rep, arena& storage) const;
+
+    /// Perform URL-decoding of a request URI into its path and query
+    /// parameters. Returns false if the encoding was invalid.
+    static bool url_decode(boost::string_view in, decoded_uri& out);
 
 private:
     /// The directory containing the files to be served.
     std::string doc_root_;
 
+    /// The open files below doc_root_.
+    mutable file_cache m_files;
 
-    /// List of server clients
-    std::map<int, std::string> m_clients;
+    /// Bodies already encrypted for their clients.
+    mutable response_cache m_responses;
 
-    /// Perform URL-decoding on a string. Returns false if the encoding was
-    /// invalid.
-    static bool url_decode(const std::string& in, std::string& out, std::map<std::string, std::string>& smap);
+    /// Key state of the server clients
+    client_table m_clients;
 };
 
 } // namespace server
@@ -9,11 +9,48 @@
 //
 
 #include "request_parser.hpp"
+#include <cstring>
 #include "request.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace http {
 namespace server {
 
+namespace {
+
+/// Find the first control character in [p, end), or the first space as well
+/// if stop_at_space is set. Bytes are checked 16 at a time where SSE2 is
+/// available.
+const char* find_ctl(const char* p, const char* end, bool stop_at_space)
+{
+#if defined(__SSE2__) && defined(__GNUC__)
+  const __m128i space = _mm_set1_epi8(stop_at_space ? ' ' : 0);
+  for (; end - p >= 16; p += 16)
+  {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i ctl = _mm_and_si128(
+        _mm_cmplt_epi8(chunk, _mm_set1_epi8(' ')),
+        _mm_cmpgt_epi8(chunk, _mm_set1_epi8(-1)));
+    ctl = _mm_or_si128(ctl, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(127)));
+    if (stop_at_space)
+      ctl = _mm_or_si128(ctl, _mm_cmpeq_epi8(chunk, space));
+    int mask = _mm_movemask_epi8(ctl);
+    if (mask != 0)
+      return p + __builtin_ctz(mask);
+  }
+#endif
+  for (; p != end; ++p)
+  {
+    if ((*p >= 0 && *p < ' ') || *p == 127 || (stop_at_space && *p == ' '))
+      return p;
+  }
+  return end;
+}
+
+} // namespace
+
 request_parser::request_parser()
   : state_(method_start)
 {
@@ -24,6 +61,115 @@ void request_parser::reset()
   state_ = method_start;
 }
 
+std::tuple<request_parser::result_type, const char*> request_parser::parse(
+    request& req, const char* begin, const char* end)
+{
+  if (state_ == method_start && parse_bulk(req, begin, end) == good)
+  {
+    return std::make_tuple(good, begin);
+  }
+
+  while (begin != end)
+  {
+    result_type result = consume(req, *begin++);
+    if (result == good || result == bad)
+      return std::make_tuple(result, begin);
+  }
+  return std::make_tuple(indeterminate, begin);
+}
+
+request_parser::result_type request_parser::parse_bulk(request& req,
+    const char*& begin, const char* end)
+{
+  // Characters allowed in the method and in header names.
+  static const struct token_table
+  {
+    bool token[256];
+
+    token_table()
+    {
+      for (int c = 0; c < 256; ++c)
+      {
+        int input = static_cast<char>(c);
+        token[c] = is_char(input) && !is_ctl(input) && !is_tspecial(input);
+      }
+    }
+  } table;
+
+  const char* p = begin;
+  auto token_end = [&p, end]() {
+    while (p != end && table.token[static_cast<unsigned char>(*p)])
+      ++p;
+  };
+  auto read_number = [&p, end](int& number) {
+    const char* start = p;
+    for (number = 0; p != end && is_digit(*p); ++p)
+      number = number * 10 + *p - '0';
+    return p != start;
+  };
+  auto fallback = [&req]() {
+    req.clear();
+    return indeterminate;
+  };
+
+  // Request line: method, URI and version.
+  const char* method_begin = p;
+  token_end();
+  if (p == method_begin || p == end || *p != ' ')
+    return fallback();
+  req.method.assign(method_begin, p);
+
+  const char* uri_begin = ++p;
+  p = find_ctl(p, end, true);
+  if (p == end || *p != ' ')
+    return fallback();
+  req.uri.assign(uri_begin, p);
+  ++p;
+
+  if (end - p < 5 || std::memcmp(p, "HTTP/", 5) != 0)
+    return fallback();
+  p += 5;
+  if (!read_number(req.http_version_major) || p == end || *p++ != '.' ||
+      !read_number(req.http_version_minor))
+    return fallback();
+  if (end - p < 2 || p[0] != '\r' || p[1] != '\n')
+    return fallback();
+  p += 2;
+
+  // Headers, up to the empty line.
+  for (;;)
+  {
+    if (p == end)
+      return fallback();
+    if (*p == '\r')
+    {
+      if (end - p < 2 || p[1] != '\n')
+        return fallback();
+      begin = p + 2;
+      return good;
+    }
+
+    const char* name_begin = p;
+    token_end();
+    if (p == name_begin || end - p < 2 || p[0] != ':' || p[1] != ' ')
+      return fallback();
+    const char* name_end = p;
+
+    const char* value_begin = p + 2;
+    p = find_ctl(value_begin, end, false);
+    if (end - p < 2 || p[0] != '\r' || p[1] != '\n')
+      return fallback();
+    header& h = req.add_header();
+    h.name.assign(name_begin, name_end);
+    h.value.assign(value_begin, p);
+    p += 2;
+
+    // Folded header lines are left to the state machine.
+    if (p != end && (*p == ' ' || *p == '\t'))
+      return fallback();
+  }
+}
+
 request_parser::result_type request_parser::consume(request& req, char input)
 {
   switch (state_)
@@ -200,8 +346,7 @@ request_parser::result_type request_parser::consume(request& req, char input)
     }
     else
     {
-      req.headers.push_back(header());
-      req.headers.back().name.push_back(input);
+      req.add_header().name.push_back(input);
       state_ = header_name;
       return indeterminate;
     }
@@ -11,6 +11,7 @@
 #ifndef HTTP_REQUEST_PARSER_HPP
 #define HTTP_REQUEST_PARSER_HPP
 
+#include <cstddef>
 #include <tuple>
 
 namespace http {
@@ -48,7 +49,28 @@ public:
     return std::make_tuple(indeterminate, begin);
   }
 
+  /// Parse some data held in contiguous memory. When a new request lies
+  /// completely in [begin, end), it is sliced out in bulk by scanning for
+  /// delimiters; a request that spans reads or looks malformed goes through
+  /// the character-by-character state machine instead.
+  std::tuple<result_type, const char*> parse(request& req,
+      const char* begin, const char* end);
+
+  std::tuple<result_type, char*> parse(request& req, char* begin, char* end)
+  {
+    result_type result;
+    const char* next;
+    std::tie(result, next) = parse(req,
+        static_cast<const char*>(begin), static_cast<const char*>(end));
+    return std::make_tuple(result, begin + (next - begin));
+  }
+
 private:
+  /// Try to parse a whole request starting at begin in one go. Returns good
+  /// and advances begin past the request on success, indeterminate if the
+  /// state machine has to take over.
+  result_type parse_bulk(request& req, const char*& begin, const char* end);
+
   /// Handle the next character of input.
   result_type consume(request& req, char input);
 
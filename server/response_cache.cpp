@@ -0,0 +1,241 @@
+//
+// response_cache.cpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "response_cache.hpp"
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+namespace http {
+namespace server {
+
+std::size_t response_cache::key_hash::operator()(const key& k) const
+{
+  // FNV-1a over the client id and the path.
+  std::uint64_t hash = 14695981039346656037ull;
+  for (int i = 0; i < 4; ++i)
+    hash = (hash ^ ((static_cast<unsigned>(k.client) >> (8 * i)) & 0xff)) *
+      1099511628211ull;
+  for (char c: k.path)
+    hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+  return static_cast<std::size_t>(hash);
+}
+
+response_cache::sketch::sketch()
+  : counters_(depth * width),
+    additions_(0)
+{
+}
+
+std::size_t response_cache::sketch::slot(std::size_t hash,
+    std::size_t row) const
+{
+  static const std::uint64_t seeds[depth] = {
+    0x9e3779b97f4a7c15ull, 0xc2b2ae3d27d4eb4full,
+    0x165667b19e3779f9ull, 0xd6e8feb86659fd93ull
+  };
+  std::uint64_t h = static_cast<std::uint64_t>(hash) * seeds[row];
+  return row * width + static_cast<std::size_t>((h >> 32) % width);
+}
+
+void response_cache::sketch::increment(std::size_t hash)
+{
+  for (std::size_t row = 0; row < depth; ++row)
+  {
+    std::uint8_t& counter = counters_[slot(hash, row)];
+    if (counter < 15)
+      ++counter;
+  }
+  if (++additions_ >= counters_.size())
+  {
+    for (std::uint8_t& counter: counters_)
+      counter >>= 1;
+    additions_ = 0;
+  }
+}
+
+unsigned response_cache::sketch::estimate(std::size_t hash) const
+{
+  unsigned count = 15;
+  for (std::size_t row = 0; row < depth; ++row)
+    count = std::min<unsigned>(count, counters_[slot(hash, row)]);
+  return count;
+}
+
+response_cache::response_cache(std::size_t capacity)
+{
+  // The split of W-TinyLFU: 1% window, the rest main, of which 80% is
+  // protected.
+  std::size_t shard_capacity = capacity / shard_count;
+  window_capacity_ = shard_capacity / 100;
+  main_capacity_ = shard_capacity - window_capacity_;
+  protected_capacity_ = main_capacity_ / 10 * 8;
+  max_body_size_ = shard_capacity / 8;
+}
+
+response_cache::body_ptr response_cache::find(int client,
+    const file_cache::file& f)
+{
+  if (max_body_size_ == 0)
+    return body_ptr();
+
+  key k = { client, f.path };
+  std::size_t hash = key_hash()(k);
+  shard& s = shards_[hash % shard_count];
+  std::lock_guard<std::mutex> lock(s.mutex);
+  s.frequency.increment(hash);
+  auto i = s.index.find(k);
+  if (i == s.index.end())
+    return body_ptr();
+  entry_list::iterator e = i->second;
+  if (!current(*e, f))
+  {
+    erase(s, e);
+    return body_ptr();
+  }
+  touch(s, e);
+  return e->body;
+}
+
+void response_cache::insert(int client, const file_cache::file& f,
+    body_ptr body)
+{
+  if (body->size() > max_body_size_)
+    return;
+
+  key k = { client, f.path };
+  std::size_t hash = key_hash()(k);
+  shard& s = shards_[hash % shard_count];
+  std::lock_guard<std::mutex> lock(s.mutex);
+  auto i = s.index.find(k);
+  if (i != s.index.end())
+  {
+    // Inserted by another thread meanwhile, or made from an older version.
+    if (current(*i->second, f))
+      return;
+    erase(s, i->second);
+  }
+
+  entry e;
+  e.client = client;
+  e.path = f.path;
+  e.inode = f.inode;
+  e.mtime = f.mtime;
+  e.body = std::move(body);
+  e.hash = hash;
+  e.charge = e.body->size() + e.path.size() + entry_overhead;
+  e.segment = window;
+  s.window.push_front(std::move(e));
+  s.window_size += s.window.front().charge;
+  s.index.emplace(key{ client, s.window.front().path }, s.window.begin());
+  rebalance(s);
+}
+
+bool response_cache::current(const entry& e, const file_cache::file& f)
+{
+  return e.inode == f.inode && e.mtime.tv_sec == f.mtime.tv_sec &&
+    e.mtime.tv_nsec == f.mtime.tv_nsec && e.body->size() == f.size;
+}
+
+response_cache::entry_list& response_cache::list_of(shard& s, const entry& e)
+{
+  switch (e.segment)
+  {
+  case window:
+    return s.window;
+  case probation:
+    return s.probation;
+  default:
+    return s.protected_segment;
+  }
+}
+
+void response_cache::touch(shard& s, entry_list::iterator e)
+{
+  if (e->segment == probation)
+  {
+    // A second use promotes an entry to the protected segment.
+    s.probation_size -= e->charge;
+    s.protected_size += e->charge;
+    s.protected_segment.splice(s.protected_segment.begin(), s.probation, e);
+    e->segment = protected_segment;
+    rebalance(s);
+    return;
+  }
+  entry_list& list = list_of(s, *e);
+  list.splice(list.begin(), list, e);
+}
+
+void response_cache::erase(shard& s, entry_list::iterator e)
+{
+  switch (e->segment)
+  {
+  case window:
+    s.window_size -= e->charge;
+    break;
+  case probation:
+    s.probation_size -= e->charge;
+    break;
+  default:
+    s.protected_size -= e->charge;
+    break;
+  }
+  s.index.erase(key{ e->client, e->path });
+  list_of(s, *e).erase(e);
+}
+
+void response_cache::rebalance(shard& s)
+{
+  while (s.protected_size > protected_capacity_)
+  {
+    entry_list::iterator e = std::prev(s.protected_segment.end());
+    s.protected_size -= e->charge;
+    s.probation_size += e->charge;
+    s.probation.splice(s.probation.begin(), s.protected_segment, e);
+    e->segment = probation;
+  }
+  while (s.window_size > window_capacity_)
+    admit(s, std::prev(s.window.end()));
+}
+
+void response_cache::admit(shard& s, entry_list::iterator candidate)
+{
+  unsigned frequency = s.frequency.estimate(candidate->hash);
+  bool compared = false;
+  while (s.probation_size + s.protected_size + candidate->charge >
+      main_capacity_)
+  {
+    entry_list& victims =
+      s.probation.empty() ? s.protected_segment : s.probation;
+    if (victims.empty())
+    {
+      erase(s, candidate);
+      return;
+    }
+    entry_list::iterator victim = std::prev(victims.end());
+    if (!compared)
+    {
+      // Ties go to the entry already cached.
+      if (frequency <= s.frequency.estimate(victim->hash))
+      {
+        erase(s, candidate);
+        return;
+      }
+      compared = true;
+    }
+    erase(s, victim);
+  }
+
+  s.window_size -= candidate->charge;
+  s.probation_size += candidate->charge;
+  s.probation.splice(s.probation.begin(), s.window, candidate);
+  candidate->segment = probation;
+}
+
+} // namespace server
+} // namespace http
@@ -0,0 +1,172 @@
+//
+// response_cache.hpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_RESPONSE_CACHE_HPP
+#define HTTP_RESPONSE_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/utility/string_view.hpp>
+#include "file_cache.hpp"
+
+namespace http {
+namespace server {
+
+/// Bodies of files already encrypted for a client, so that serving one again
+/// takes neither disk reads nor encryption. Entries are keyed by client id
+/// and path and remember the version of the file they were made from; an
+/// entry for an older version is dropped when it is looked up.
+///
+/// The memory budget is kept with W-TinyLFU: new entries go into a small LRU
+/// window, and an entry leaving the window only displaces an entry of the
+/// main segmented LRU if it has been requested more often, as estimated by a
+/// count-min sketch whose counters are halved periodically. One-off requests
+/// thus churn only the window. Safe for concurrent use: the entries are
+/// spread over shards with a lock each.
+class response_cache
+{
+public:
+  typedef std::shared_ptr<const std::string> body_ptr;
+
+  response_cache(const response_cache&) = delete;
+  response_cache& operator=(const response_cache&) = delete;
+
+  /// Construct a cache holding up to capacity bytes; zero turns it off.
+  explicit response_cache(std::size_t capacity);
+
+  /// The size of the largest body that is cached.
+  std::uint64_t max_body_size() const
+  {
+    return max_body_size_;
+  }
+
+  /// The body of f encrypted for client, or null. Counts as a request for
+  /// admission either way.
+  body_ptr find(int client, const file_cache::file& f);
+
+  /// Add the body of f encrypted for client.
+  void insert(int client, const file_cache::file& f, body_ptr body);
+
+private:
+  enum segment_type
+  {
+    window,
+    probation,
+    protected_segment
+  };
+
+  struct entry
+  {
+    int client;
+    std::string path;
+    ino_t inode;
+    struct timespec mtime;
+    body_ptr body;
+    std::size_t hash;
+    std::size_t charge;
+    segment_type segment;
+  };
+
+  typedef std::list<entry> entry_list;
+
+  /// A view of the key of an entry.
+  struct key
+  {
+    int client;
+    boost::string_view path;
+
+    bool operator==(const key& other) const
+    {
+      return client == other.client && path == other.path;
+    }
+  };
+
+  struct key_hash
+  {
+    std::size_t operator()(const key& k) const;
+  };
+
+  /// Estimated request counts. Each counter saturates at 15, and all are
+  /// halved once as many requests have been counted as there are counters,
+  /// so that the estimate follows changes in popularity.
+  class sketch
+  {
+  public:
+    sketch();
+    void increment(std::size_t hash);
+    unsigned estimate(std::size_t hash) const;
+
+  private:
+    static const std::size_t depth = 4;
+    static const std::size_t width = 4096;
+
+    std::size_t slot(std::size_t hash, std::size_t row) const;
+
+    std::vector<std::uint8_t> counters_;
+    std::size_t additions_;
+  };
+
+  /// A share of the entries with its own budget, each segment in LRU order
+  /// with the most recently used first.
+  struct shard
+  {
+    shard() : window_size(0), probation_size(0), protected_size(0) {}
+
+    std::mutex mutex;
+    entry_list window;
+    entry_list probation;
+    entry_list protected_segment;
+    std::unordered_map<key, entry_list::iterator, key_hash> index;
+    sketch frequency;
+    std::size_t window_size;
+    std::size_t probation_size;
+    std::size_t protected_size;
+  };
+
+  static const std::size_t shard_count = 16;
+
+  /// The bytes accounted for an entry besides its body.
+  static const std::size_t entry_overhead = 128;
+
+  /// Whether e was made from f.
+  static bool current(const entry& e, const file_cache::file& f);
+
+  /// The list of s that e is in.
+  static entry_list& list_of(shard& s, const entry& e);
+
+  /// Move a used entry towards the protected segment.
+  void touch(shard& s, entry_list::iterator e);
+
+  /// Remove an entry from s.
+  void erase(shard& s, entry_list::iterator e);
+
+  /// Keep the window and the protected segment within their budgets, moving
+  /// what does not fit on to the next segment.
+  void rebalance(shard& s);
+
+  /// Let the candidate leaving the window into the main segments if it is
+  /// requested more often than the entry it would evict.
+  void admit(shard& s, entry_list::iterator candidate);
+
+  std::size_t window_capacity_;
+  std::size_t main_capacity_;
+  std::size_t protected_capacity_;
+  std::uint64_t max_body_size_;
+  shard shards_[shard_count];
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_RESPONSE_CACHE_HPP
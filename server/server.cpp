@@ -10,18 +10,26 @@
 
 #include "server.hpp"
 #include <signal.h>
+#include <sys/socket.h>
+#include <thread>
 #include <utility>
 
 namespace http {
 namespace server {
 
+const std::size_t server::offload_capacity;
+
 server::server(const std::string& address, const std::string& port,
-    const std::string& doc_root, const std::map<int, std::string>& clients)
-  : io_context_(1),
-    signals_(io_context_),
-    acceptor_(io_context_),
-    connection_manager_(),
-    request_handler_(doc_root, clients)
+    const std::string& doc_root, const std::map<int, std::string>& clients,
+    std::size_t threads, const admission_limits& limits,
+    std::size_t response_cache_size, bool use_io_uring,
+    std::size_t offload_threads, const std::string& access_log_path)
+  : request_handler_(doc_root, clients, response_cache_size),
+    offload_pool_(offload_threads, offload_capacity),
+    access_log_(access_log_path),
+    workers_(make_workers(address, port, threads, request_handler_, limits,
+          use_io_uring, offload_pool_, access_log_)),
+    signals_(workers_.front()->io_context())
 {
   // Register to handle the signals that indicate when the server should exit.
   // It is safe to register for the same signal multiple times in a program,
@@ -33,48 +41,54 @@ server::server(const std::string& address, const std::string& port,
 #endif // defined(SIGQUIT)
 
   do_await_stop();
+}
 
-  // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
-  boost::asio::ip::tcp::resolver resolver(io_context_);
+std::vector<std::unique_ptr<worker>> server::make_workers(
+    const std::string& address, const std::string& port,
+    std::size_t threads, request_handler& handler,
+    const admission_limits& limits, bool use_io_uring,
+    offload_pool& offload, access_log& log)
+{
+#if !defined(SO_REUSEPORT)
+  // Without SO_REUSEPORT only one acceptor may listen on the endpoint.
+  threads = 1;
+#endif // !defined(SO_REUSEPORT)
+  if (threads == 0)
+    threads = 1;
+
+  boost::asio::io_context io_context;
+  boost::asio::ip::tcp::resolver resolver(io_context);
   boost::asio::ip::tcp::endpoint endpoint =
     *resolver.resolve(address, port).begin();
-  acceptor_.open(endpoint.protocol());
-  acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-  acceptor_.bind(endpoint);
-  acceptor_.listen();
 
-  do_accept();
-}
+  // The kernel spreads connections evenly over the workers, so each one
+  // gets an even share of the caps.
+  admission_limits worker_limits = limits;
+  worker_limits.max_connections = (limits.max_connections + threads - 1) / threads;
+  worker_limits.max_requests = (limits.max_requests + threads - 1) / threads;
 
-void server::run()
-{
-  // The io_context::run() call will block until all asynchronous operations
-  // have finished. While the server is running, there is always at least one
-  // asynchronous operation outstanding: the asynchronous accept call waiting
-  // for new incoming connections.
-  io_context_.run();
+  std::vector<std::unique_ptr<worker>> workers;
+  workers.reserve(threads);
+  for (std::size_t i = 0; i < threads; ++i)
+    workers.emplace_back(
+        new worker(endpoint, threads > 1, handler, worker_limits,
+          use_io_uring, offload, log));
+  return workers;
 }
 
-void server::do_accept()
+void server::run()
 {
-  acceptor_.async_accept(
-      [this](boost::system::error_code ec, boost::asio::ip::tcp::socket socket)
-      {
-        // Check whether the server was stopped by a signal before this
-        // completion handler had a chance to run.
-        if (!acceptor_.is_open())
-        {
-          return;
-        }
+  // Every worker but the first gets its own thread; the first one runs on the
+  // calling thread together with the signal handling.
+  std::vector<std::thread> threads;
+  threads.reserve(workers_.size() - 1);
+  for (std::size_t i = 1; i < workers_.size(); ++i)
+    threads.emplace_back(&worker::run, workers_[i].get());
 
-        if (!ec)
-        {
-          connection_manager_.start(std::make_shared<connection>(
-              std::move(socket), connection_manager_, request_handler_));
-        }
+  workers_.front()->run();
 
-        do_accept();
-      });
+  for (std::thread& t: threads)
+    t.join();
 }
 
 void server::do_await_stop()
@@ -83,10 +97,10 @@ void server::do_await_stop()
       [this](boost::system::error_code /*ec*/, int /*signo*/)
       {
         // The server is stopped by cancelling all outstanding asynchronous
-        // operations. Once all operations have finished the io_context::run()
-        // call will exit.
-        acceptor_.close();
-        connection_manager_.stop_all();
+        // operations. Once all operations have finished each worker's
+        // io_context::run() call will exit.
+        for (auto& w: workers_)
+          w->stop();
       });
 }
 
@@ -12,10 +12,14 @@
 #define HTTP_SERVER_HPP
 
 #include <boost/asio.hpp>
+#include <cstddef>
+#include <memory>
 #include <string>
-#include "connection.hpp"
-#include "connection_manager.hpp"
+#include <vector>
+#include "access_log.hpp"
+#include "offload_pool.hpp"
 #include "request_handler.hpp"
+#include "worker.hpp"
 
 namespace http {
 namespace server {
@@ -27,34 +31,57 @@ public:
     server& operator=(const server&) = delete;
 
     /// Construct the server to listen on the specified TCP address and port, and
-    /// serve up files from the given directory.
+    /// serve up files from the given directory. The server runs the given
+    /// number of workers, each with its own thread, io_context and acceptor.
+    /// Up to response_cache_size bytes of encrypted bodies are kept in memory.
+    /// With use_io_uring the workers stream files through io_uring. Files are
+    /// read and encrypted by offload_threads threads of their own, or by the
+    /// workers themselves if there are none. Requests are logged to the file
+    /// at access_log_path, if given.
     explicit server(const std::string& address, const std::string& port,
-      const std::string& doc_root, const std::map<int, std::string>& clients);
+      const std::string& doc_root, const std::map<int, std::string>& clients,
+      std::size_t threads = 1,
+      const admission_limits& limits = admission_limits(),
+      std::size_t response_cache_size =
+        request_handler::default_response_cache_size,
+      bool use_io_uring = false, std::size_t offload_threads = 0,
+      const std::string& access_log_path = std::string());
 
-    /// Run the server's io_context loop.
+    /// Run the workers' io_context loops. Blocks until the server is stopped.
     void run();
 
 private:
-    /// Perform an asynchronous accept operation.
-    void do_accept();
+    /// The number of tasks the offload pool queues before the workers do the
+    /// work themselves.
+    static const std::size_t offload_capacity = 4096;
+
+    /// Create the workers listening on the resolved endpoint.
+    static std::vector<std::unique_ptr<worker>> make_workers(
+      const std::string& address, const std::string& port,
+      std::size_t threads, request_handler& handler,
+      const admission_limits& limits, bool use_io_uring,
+      offload_pool& offload, access_log& log);
 
     /// Wait for a request to stop the server.
     void do_await_stop();
 
-    /// The io_context used to perform asynchronous operations.
-    boost::asio::io_context io_context_;
+    /// The handler for all incoming requests, shared by all workers.
+    request_handler request_handler_;
 
-    /// The signal_set is used to register for process termination notifications.
-    boost::asio::signal_set signals_;
+    /// The threads for blocking work, shared by all workers, which must not
+    /// be stopped before them.
+    offload_pool offload_pool_;
 
-    /// Acceptor used to listen for incoming connections.
-    boost::asio::ip::tcp::acceptor acceptor_;
+    /// The log of the requests served by all workers, which must outlive
+    /// them.
+    access_log access_log_;
 
-    /// The connection manager which owns all live connections.
-    connection_manager connection_manager_;
+    /// The workers, one per thread.
+    std::vector<std::unique_ptr<worker>> workers_;
 
-    /// The handler for all incoming requests.
-    request_handler request_handler_;
+    /// The signal_set is used to register for process termination notifications.
+    /// It is served by the first worker's io_context.
+    boost::asio::signal_set signals_;
 };
 
 } // namespace server
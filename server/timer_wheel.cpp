@@ -0,0 +1,133 @@
+//
+// timer_wheel.cpp
+// ~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "timer_wheel.hpp"
+#include <algorithm>
+
+namespace http {
+namespace server {
+
+timer_wheel::entry::entry()
+  : link_(nullptr),
+    next_(nullptr),
+    expiry_(0)
+{
+}
+
+timer_wheel::entry::~entry()
+{
+  unlink();
+}
+
+void timer_wheel::entry::unlink()
+{
+  if (!link_)
+    return;
+  *link_ = next_;
+  if (next_)
+    next_->link_ = link_;
+  link_ = nullptr;
+  next_ = nullptr;
+}
+
+timer_wheel::timer_wheel(boost::asio::io_context& io_context,
+    std::chrono::steady_clock::duration tick)
+  : timer_(io_context),
+    tick_(tick),
+    start_(std::chrono::steady_clock::now()),
+    now_(0),
+    stopped_(false),
+    delay_(0),
+    slots_()
+{
+  do_wait();
+}
+
+void timer_wheel::schedule(entry& e, std::chrono::steady_clock::duration timeout)
+{
+  e.unlink();
+
+  // Round the deadline up to a tick, so that it never fires early, and stay
+  // within the span of the wheel. The current tick may lag behind the clock.
+  const std::uint64_t max_ticks = (std::uint64_t(1) << (slot_bits * level_count)) - 1;
+  std::chrono::steady_clock::duration deadline =
+    std::chrono::steady_clock::now() - start_ + timeout;
+  std::uint64_t expiry = (deadline + tick_ - std::chrono::steady_clock::duration(1)) / tick_;
+  e.expiry_ = std::max(now_ + 1, std::min(expiry, now_ + max_ticks));
+  insert(e);
+}
+
+void timer_wheel::stop()
+{
+  // The wait may already have completed, so cancelling alone is not enough.
+  stopped_ = true;
+  timer_.cancel();
+}
+
+void timer_wheel::do_wait()
+{
+  timer_.expires_at(start_ + tick_ * static_cast<std::int64_t>(now_ + 1));
+  timer_.async_wait(
+      [this](boost::system::error_code ec)
+      {
+        if (ec || stopped_)
+          return;
+
+        // Catch up with the clock if the loop was busy for several ticks.
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        delay_ = now - timer_.expiry();
+        std::uint64_t target = (now - start_) / tick_;
+        while (now_ < target)
+          advance();
+        do_wait();
+      });
+}
+
+void timer_wheel::advance()
+{
+  ++now_;
+
+  // Whenever a level completes a turn, the next slot of the level above is
+  // due and its entries are spread over the levels below.
+  for (std::size_t level = 1; level < level_count; ++level)
+  {
+    if ((now_ >> (slot_bits * (level - 1))) & (slot_count - 1))
+      break;
+    entry*& head = slots_[level][(now_ >> (slot_bits * level)) & (slot_count - 1)];
+    while (entry* e = head)
+    {
+      e->unlink();
+      insert(*e);
+    }
+  }
+
+  entry*& head = slots_[0][now_ & (slot_count - 1)];
+  while (entry* e = head)
+  {
+    e->unlink();
+    e->expired();
+  }
+}
+
+void timer_wheel::insert(entry& e)
+{
+  std::uint64_t delta = e.expiry_ > now_ ? e.expiry_ - now_ : 0;
+  std::size_t level = 0;
+  while (level + 1 < level_count && delta >= (std::uint64_t(1) << (slot_bits * (level + 1))))
+    ++level;
+  std::uint64_t expiry = e.expiry_ > now_ ? e.expiry_ : now_;
+  entry*& head = slots_[level][(expiry >> (slot_bits * level)) & (slot_count - 1)];
+  e.link_ = &head;
+  e.next_ = head;
+  if (head)
+    head->link_ = &e.next_;
+  head = &e;
+}
+
+} // namespace server
+} // namespace http
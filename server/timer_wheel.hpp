@@ -0,0 +1,127 @@
+//
+// timer_wheel.hpp
+// ~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_TIMER_WHEEL_HPP
+#define HTTP_TIMER_WHEEL_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <boost/asio.hpp>
+
+namespace http {
+namespace server {
+
+/// Deadlines for many objects driven by a single steady_timer. Deadlines are
+/// kept in a hierarchical timing wheel: each level has 64 slots, a slot of
+/// the first level spans one tick and a slot of each further level spans a
+/// whole turn of the level below. Scheduling and cancelling are O(1); a
+/// deadline is moved down a level at most once per level on its way to
+/// expiry. Deadlines fire up to one tick late. Not thread-safe: the wheel
+/// belongs to a single io_context thread.
+class timer_wheel
+{
+public:
+  /// A deadline that can be in the wheel. Unlinks itself when destroyed.
+  class entry
+  {
+  public:
+    entry(const entry&) = delete;
+    entry& operator=(const entry&) = delete;
+
+    entry();
+    virtual ~entry();
+
+    /// Whether the deadline is scheduled.
+    bool scheduled() const
+    {
+      return link_ != nullptr;
+    }
+
+    /// Called by the wheel when the deadline has passed. The entry is no
+    /// longer scheduled at that point.
+    virtual void expired() = 0;
+
+  private:
+    friend class timer_wheel;
+
+    /// Remove the entry from its slot, if any.
+    void unlink();
+
+    /// The pointer to this entry in its slot list, or null when unscheduled.
+    entry** link_;
+    entry* next_;
+    std::uint64_t expiry_;
+  };
+
+  timer_wheel(const timer_wheel&) = delete;
+  timer_wheel& operator=(const timer_wheel&) = delete;
+
+  /// Construct a wheel advancing by the given tick on the io_context.
+  timer_wheel(boost::asio::io_context& io_context,
+      std::chrono::steady_clock::duration tick);
+
+  /// Schedule e to expire after timeout, replacing its previous deadline.
+  void schedule(entry& e, std::chrono::steady_clock::duration timeout);
+
+  /// Cancel the deadline of e, if scheduled.
+  void cancel(entry& e)
+  {
+    e.unlink();
+  }
+
+  /// Stop the timer; the wheel fires no more deadlines.
+  void stop();
+
+  /// How late the last tick ran: the time the event loop took to get to it,
+  /// which is the time any event currently waits to be handled.
+  std::chrono::steady_clock::duration delay() const
+  {
+    return delay_;
+  }
+
+private:
+  /// Wait for the next tick.
+  void do_wait();
+
+  /// Advance by one tick and fire the deadlines that fall on it.
+  void advance();
+
+  /// Put e into the slot its expiry falls in, relative to the current tick.
+  void insert(entry& e);
+
+  static const std::size_t slot_bits = 6;
+  static const std::size_t slot_count = std::size_t(1) << slot_bits;
+  static const std::size_t level_count = 4;
+
+  /// The timer driving the wheel.
+  boost::asio::steady_timer timer_;
+
+  /// The length of a tick.
+  std::chrono::steady_clock::duration tick_;
+
+  /// The time of tick 0.
+  std::chrono::steady_clock::time_point start_;
+
+  /// The current tick.
+  std::uint64_t now_;
+
+  /// Whether stop() has been called.
+  bool stopped_;
+
+  /// How late the last tick ran.
+  std::chrono::steady_clock::duration delay_;
+
+  /// The slots; each is the head of a list of entries.
+  entry* slots_[level_count][slot_count];
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_TIMER_WHEEL_HPP
@@ -0,0 +1,126 @@
+//
+// worker.cpp
+// ~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "worker.hpp"
+#include <sys/socket.h>
+#include <utility>
+#include "metrics.hpp"
+
+namespace http {
+namespace server {
+
+#if defined(SO_REUSEPORT)
+typedef boost::asio::detail::socket_option::boolean<
+    SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif // defined(SO_REUSEPORT)
+
+worker::worker(const boost::asio::ip::tcp::endpoint& endpoint,
+    bool reuse_port, request_handler& handler, const admission_limits& limits,
+    bool use_io_uring, offload_pool& offload, access_log& log)
+  : io_context_(1),
+    acceptor_(io_context_),
+    timer_wheel_(io_context_, std::chrono::milliseconds(100)),
+    admission_control_(limits, timer_wheel_),
+    io_ring_(io_context_, use_io_uring),
+    connection_pool_(io_context_, connection_manager_, handler, timer_wheel_,
+        admission_control_, io_ring_, offload, log.make_ring(),
+        preallocated_connections),
+    connection_manager_(),
+    request_handler_(handler)
+{
+  // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
+  acceptor_.open(endpoint.protocol());
+  acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+#if defined(SO_REUSEPORT)
+  if (reuse_port)
+    acceptor_.set_option(http::server::reuse_port(true));
+#else // defined(SO_REUSEPORT)
+  (void)reuse_port;
+#endif // defined(SO_REUSEPORT)
+  acceptor_.bind(endpoint);
+  acceptor_.listen();
+
+  do_accept();
+}
+
+boost::asio::io_context& worker::io_context()
+{
+  return io_context_;
+}
+
+void worker::run()
+{
+  // The io_context::run() call will block until all asynchronous operations
+  // have finished. While the worker is running, there is always at least one
+  // asynchronous operation outstanding: the asynchronous accept call waiting
+  // for new incoming connections.
+  io_context_.run();
+}
+
+void worker::stop()
+{
+  // The acceptor and the connections belong to the worker's thread, so the
+  // shutdown is performed there.
+  boost::asio::post(io_context_,
+      [this]()
+      {
+        acceptor_.close();
+        admission_control_.stop();
+        timer_wheel_.stop();
+        connection_manager_.stop_all();
+        io_ring_.stop();
+      });
+}
+
+void worker::do_accept()
+{
+  acceptor_.async_accept(
+      [this](boost::system::error_code ec, boost::asio::ip::tcp::socket socket)
+      {
+        // Check whether the worker was stopped before this completion handler
+        // had a chance to run.
+        if (!acceptor_.is_open())
+        {
+          return;
+        }
+
+        if (!ec)
+        {
+          if (admission_control_.admit_connection(connection_manager_.size()))
+            connection_manager_.start(
+                connection_pool_.acquire(std::move(socket)));
+          else
+            shed(socket);
+        }
+
+        do_accept();
+      });
+}
+
+void worker::shed(boost::asio::ip::tcp::socket& socket)
+{
+  // The reply fits into the send buffer of a new socket, so a non-blocking
+  // send writes it at once.
+  boost::system::error_code ignored_ec;
+  socket.non_blocking(true, ignored_ec);
+  socket.send(boost::asio::buffer(reply::overloaded_buffer()), 0, ignored_ec);
+  metrics::count_status(reply::service_unavailable);
+  socket.shutdown(boost::asio::ip::tcp::socket::shutdown_send, ignored_ec);
+
+  // Closing with unread input resets the connection, which may discard the
+  // reply before the client reads it. Drain what has arrived so far.
+  char discard[512];
+  boost::system::error_code ec;
+  while (socket.receive(boost::asio::buffer(discard), 0, ec) > 0 && !ec)
+  {
+  }
+  socket.close(ignored_ec);
+}
+
+} // namespace server
+} // namespace http
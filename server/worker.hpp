@@ -0,0 +1,95 @@
+//
+// worker.hpp
+// ~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_WORKER_HPP
+#define HTTP_WORKER_HPP
+
+#include <boost/asio.hpp>
+#include "access_log.hpp"
+#include "admission_control.hpp"
+#include "connection.hpp"
+#include "connection_manager.hpp"
+#include "connection_pool.hpp"
+#include "io_ring.hpp"
+#include "offload_pool.hpp"
+#include "request_handler.hpp"
+#include "timer_wheel.hpp"
+
+namespace http {
+namespace server {
+
+/// A single-threaded event loop with its own acceptor and connections. The
+/// server runs one worker per thread; workers share nothing but the
+/// request_handler, the offload_pool and the access_log, which are safe for
+/// concurrent use.
+class worker
+{
+public:
+  worker(const worker&) = delete;
+  worker& operator=(const worker&) = delete;
+
+  /// Construct a worker listening on the given endpoint. When reuse_port is
+  /// set the acceptor is opened with SO_REUSEPORT so that several workers can
+  /// bind the same endpoint and let the kernel balance incoming connections.
+  /// The limits apply to this worker alone. With use_io_uring the bodies of
+  /// files are read and sent through an io_uring, where available. Blocking
+  /// work on the bodies is done by the offload pool. Requests are logged to
+  /// the access log. Both must outlive the worker.
+  worker(const boost::asio::ip::tcp::endpoint& endpoint, bool reuse_port,
+      request_handler& handler, const admission_limits& limits,
+      bool use_io_uring, offload_pool& offload, access_log& log);
+
+  /// The io_context owned by this worker.
+  boost::asio::io_context& io_context();
+
+  /// Run the worker's io_context loop.
+  void run();
+
+  /// Stop accepting and close all connections. May be called from any thread.
+  void stop();
+
+private:
+  /// Perform an asynchronous accept operation.
+  void do_accept();
+
+  /// Turn away a connection over the limit with a 503 reply, without
+  /// allocating anything for it.
+  static void shed(boost::asio::ip::tcp::socket& socket);
+
+  /// The number of connection objects made ready up front.
+  static const std::size_t preallocated_connections = 32;
+
+  /// The io_context used to perform asynchronous operations.
+  boost::asio::io_context io_context_;
+
+  /// Acceptor used to listen for incoming connections.
+  boost::asio::ip::tcp::acceptor acceptor_;
+
+  /// The deadlines of the connections.
+  timer_wheel timer_wheel_;
+
+  /// Decides which connections and requests are served.
+  admission_control admission_control_;
+
+  /// The ring for file reads and socket sends, if enabled.
+  io_ring io_ring_;
+
+  /// The recycled connection objects, which must outlive the connections.
+  connection_pool connection_pool_;
+
+  /// The connection manager which owns all live connections of this worker.
+  connection_manager connection_manager_;
+
+  /// The handler for all incoming requests.
+  request_handler& request_handler_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_WORKER_HPP
@@ -0,0 +1,142 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../server/decoded_uri.hpp"
+#include "../server/file_cache.hpp"
+#include "../server/request_handler.hpp"
+
+using namespace http::server;
+
+/// Regression tests of the server, run by ctest. Each test returns normally
+/// or reports its failed checks through CHECK; the process fails if any did.
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            ++failures; \
+        } \
+    } while (false)
+
+void test_url_decode_escape_before_long_query() {
+    // An escaped path reserves decoded text for the path alone, so a query
+    // longer than the text buffer still fits when it needs no decoding.
+    std::string uri = "/%64/f?id=0&pad=" + std::string(2100, 'x');
+    decoded_uri out;
+    CHECK(request_handler::url_decode(uri, out));
+    CHECK(out.path() == "/d/f");
+    boost::string_view value;
+    CHECK(out.find("id", value) && value == "0");
+    CHECK(out.find("pad", value) && value.size() == 2100);
+
+    // The same goes for an escaped parameter before a long one.
+    uri = "/d/f?id=%30&pad=" + std::string(2100, 'x');
+    CHECK(request_handler::url_decode(uri, out));
+    CHECK(out.find("id", value) && value == "0");
+
+    // Text that does need decoding is still bounded by the buffer.
+    uri = "/d/f?pad=%78" + std::string(decoded_uri::text_capacity, 'x');
+    CHECK(!request_handler::url_decode(uri, out));
+}
+
+/// A temporary document root, removed with whatever is left in it on exit.
+class doc_root {
+public:
+    doc_root() {
+        char dir[] = "/tmp/http_tests.XXXXXX";
+        if (mkdtemp(dir) == nullptr)
+            throw std::runtime_error("can't create temporary doc root");
+        m_path = dir;
+    }
+
+    ~doc_root() {
+        std::string command = "rm -rf '" + m_path + "'";
+        if (std::system(command.c_str()) != 0)
+            std::cerr << "can't remove " << m_path << std::endl;
+    }
+
+    const std::string& path() const {
+        return m_path;
+    }
+
+    void write(const std::string& file, const std::string& content) const {
+        std::ofstream os(m_path + file, std::ios::binary | std::ios::trunc);
+        os << content;
+    }
+
+private:
+    std::string m_path;
+};
+
+/// Wait up to two seconds for the cache to notice a change, which arrives
+/// through its watcher thread.
+bool wait_for(const std::function<bool()>& condition) {
+    for (int i = 0; i < 200; ++i) {
+        if (condition())
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+void test_file_cache_directory_replaced() {
+    // A directory moved away and created anew under its old name is watched
+    // again: changes to its files reach the cache.
+    doc_root root;
+    CHECK(::mkdir((root.path() + "/d").c_str(), 0755) == 0);
+    root.write("/d/f", "one\n");
+    file_cache cache(root.path(), 64);
+    auto size = [&cache]() {
+        file_cache::file_ptr f = cache.open("/d/f");
+        return f ? f->size : 0;
+    };
+    CHECK(size() == 4);
+
+    CHECK(std::rename((root.path() + "/d").c_str(), (root.path() + "/d_old").c_str()) == 0);
+    CHECK(::mkdir((root.path() + "/d").c_str(), 0755) == 0);
+    root.write("/d/f", "twotwo\n");
+    CHECK(wait_for([&size]() { return size() == 7; }));
+
+    root.write("/d/f", "threethree\n");
+    CHECK(wait_for([&size]() { return size() == 11; }));
+
+    // Changes in the directory that moved away are not taken for changes
+    // to the new one.
+    root.write("/d_old/f", "four four four\n");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(size() == 11);
+}
+
+struct test {
+    const char* name;
+    std::function<void()> run;
+};
+
+}
+
+int main() {
+    const std::vector<test> tests = {
+        {"url_decode_escape_before_long_query", test_url_decode_escape_before_long_query},
+        {"file_cache_directory_replaced", test_file_cache_directory_replaced},
+    };
+
+    for (const test& t: tests) {
+        int before = failures;
+        t.run();
+        std::cout << (failures == before ? "ok     " : "FAILED ") << t.name << std::endl;
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
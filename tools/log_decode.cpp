@@ -0,0 +1,109 @@
+// Converts a binary access log written by the server to text, one line per
+// request. Paths are logged as hashes; given the document root, the hashes
+// of the files below it are turned back into their paths.
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <ftw.h>
+
+#include "../args_serializer.h"
+#include "../server/access_log.hpp"
+
+using http::server::access_log;
+
+namespace {
+
+std::unordered_map<std::uint64_t, std::string> paths;
+std::size_t root_length;
+
+int add_path(const char *file, const struct stat *, int type, struct FTW *) {
+    if (type == FTW_F) {
+        std::string path(file + root_length);
+        paths.emplace(access_log::hash_path(path.data(), path.size()), path);
+    }
+    return 0;
+}
+
+/// Map the hashes of the paths of the files below root to the paths, as the
+/// request handler resolves them.
+void load_paths(std::string root) {
+    while (root.size() > 1 && root.back() == '/')
+        root.pop_back();
+    root_length = root.size();
+    ::nftw(root.c_str(), add_path, 16, FTW_PHYS);
+}
+
+void print(std::ostream& out, const access_log::record& r) {
+    std::time_t seconds = static_cast<std::time_t>(r.time / 1000000000);
+    struct tm utc;
+    ::gmtime_r(&seconds, &utc);
+    char time[64];
+    std::size_t n = std::strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", &utc);
+    std::snprintf(time + n, sizeof(time) - n, ".%09lluZ",
+                  static_cast<unsigned long long>(r.time % 1000000000));
+    out << time;
+
+    if (r.status == 0) {
+        out << " dropped=" << r.bytes << '\n';
+        return;
+    }
+
+    out << " client=" << r.client << " status=" << r.status << " bytes=" << r.bytes;
+    char latency[32];
+    std::snprintf(latency, sizeof(latency), "%.3f", r.latency / 1000.0);
+    out << " latency_us=" << latency << " path=";
+    auto path = paths.find(r.path_hash);
+    if (path != paths.end()) {
+        out << path->second << '\n';
+    } else {
+        char hash[24];
+        std::snprintf(hash, sizeof(hash), "#%016llx", static_cast<unsigned long long>(r.path_hash));
+        out << hash << '\n';
+    }
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    serialize::map smap;
+    std::string file;
+    std::string root;
+
+    serialize::args(argc, argv, smap)
+    .handle("file", [&] (const serialize::values& values, const std::string& error) {
+        file = !values.empty() && values.front() != "true" ? values.front() : "";
+    })
+    .handle("root", [&] (const serialize::values& values, const std::string& error) {
+        root = !values.empty() && values.front() != "true" ? values.front() : "";
+    });
+
+    if (file.empty()) {
+        std::cerr << "usage: http_log_decode file=<access log> [root=<document root>]" << std::endl;
+        return 1;
+    }
+
+    std::ifstream in(file, std::ios::binary);
+    char magic[sizeof(access_log::file_magic)];
+    if (!in.read(magic, sizeof(magic)) ||
+        !std::equal(magic, magic + sizeof(magic), access_log::file_magic)) {
+        std::cerr << "error: " << file << " is not an access log" << std::endl;
+        return 2;
+    }
+
+    if (!root.empty())
+        load_paths(root);
+
+    access_log::record r;
+    while (in.read(reinterpret_cast<char *>(&r), sizeof(r)))
+        print(std::cout, r);
+    if (in.gcount() != 0) {
+        std::cerr << "error: " << file << " ends with a partial record" << std::endl;
+        return 3;
+    }
+    return 0;
+}